@@ -29,7 +29,16 @@ enum TrapCalls
   TrapJail = 0x6c69614a,
   TrapUnjail = 0x6c6a6e55,
   TrapExit = 0x74697845,
-  TrapFork = 0x6b726f46
+  TrapFork = 0x6b726f46,
+  TrapPoll = 0x6c6c6f50,
+  TrapRead64 = 0x34366452,
+  TrapWrite64 = 0x34367257,
+  TrapRelease = 0x656c6552,
+  TrapThread = 0x64726854,
+  TrapJoin = 0x6e696f4a,
+  TrapSpawn = 0x6e777053,
+  TrapWait = 0x74696157,
+  TrapSave = 0x65766153
 };
 
 /* channel types */
@@ -58,6 +67,16 @@ struct ZVMChannel
   char *name;
 };
 
+/* channel state. zerovm updates it upon each channel i/o */
+struct ZVMChannelState
+{
+  int64_t getpos;
+  int64_t putpos;
+  int64_t size;
+  int64_t counters[LimitsNumber]; /* used limits, see ZVMChannel limits */
+  int64_t eof; /* not 0 if end of channel reached */
+};
+
 /* system data available for the user */
 struct UserManifest
 {
@@ -66,13 +85,15 @@ struct UserManifest
   uint32_t stack_size;
   int32_t channels_count;
   struct ZVMChannel *channels;
+  const struct ZVMChannelState *channels_state; /* live, read only */
 };
 
 /* pointer to the user manifest (read only memory area) */
 #define MANIFEST ((const struct UserManifest const *)*((uintptr_t*)0xFEFFFFFC))
 
-/* trap pointer. internal helper. DO NOT use it! */
+/* trap pointers. internal helpers. DO NOT use it! */
 #define TRAP ((int32_t (*)(uint64_t*))0x10000)
+#define TRAP64 ((int64_t (*)(uint64_t*))0x10000)
 
 /*
  * trap functions
@@ -81,29 +102,71 @@ struct UserManifest
  *   read from "offset" position of "desc" channel "size" bytes to "buffer"
  * zvm_pwrite
  *   write to "offset" position of "desc" channel "size" bytes from "buffer"
+ * zvm_pread64, zvm_pwrite64
+ *   same as above, but "size" and the result are 64-bit
  * zvm_jail
  *   validate "size" bytes from "buffer" and (if ok) protect it with read/exec
  *   "buffer" should be 64kb aligned and point to heap
  * zvm_unjail
  *   protect "size" bytes from "buffer" with read/write
  *   "buffer" should be 64kb aligned and point to heap
+ * zvm_release
+ *   give "size" bytes from "buffer" back to the host. the memory stays
+ *   available and becomes read/write, filled with zeroes
+ *   "buffer" should be 64kb aligned and point to heap
  * zvm_exit
  *   terminate program with "code"
  * zvm_fork
  *   ask for fork (for further details see "daemon mode")
+ * zvm_poll
+ *   wait up to "timeout" milliseconds (-1 means infinite) until at least one
+ *   of "count" channels listed in "set" has data or eof pending. numbers of
+ *   the channels which are not ready will be replaced with -1 in "set"
+ * zvm_thread
+ *   start a thread running "func(arg)" on the stack ("stack", "size")
+ *   allocated from the heap. return the thread id. the thread must be
+ *   finished with zvm_exit() which only terminates the calling thread
+ *   (unless it is the main one). zvm_fork() fails while threads exist
+ * zvm_join
+ *   wait until thread "id" is finished and return its exit code
+ * zvm_spawn
+ *   fork "count" sessions sharing the memory copy-on-write. return 0 to
+ *   the caller and the session index (1..count) to the spawned sessions
+ * zvm_wait
+ *   wait for "count" spawned sessions and put their exit codes to "codes"
+ *   (-1 for failed sessions). return the number of failed sessions
+ * zvm_save
+ *   save the session image to the manifest "Save" file. return 0 to the
+ *   caller and 1 to the session restored from the image
  *
  * all trap functions return -errno code if error encountered, otherwise
- * result equal to processed bytes or 0 (for (un)jail). exit does not return
+ * result equal to processed bytes or 0 (for (un)jail and release). poll returns number
+ * of ready channels (0 if timeout expired). exit does not return
  */
 #define zvm_pread(desc, buffer, size, offset) \
   TRAP((uint64_t[]){TrapRead, 0, desc, (uintptr_t)buffer, size, offset})
 #define zvm_pwrite(desc, buffer, size, offset) \
   TRAP((uint64_t[]){TrapWrite, 0, desc, (uintptr_t)buffer, size, offset})
+#define zvm_pread64(desc, buffer, size, offset) \
+  TRAP64((uint64_t[]){TrapRead64, 0, desc, (uintptr_t)buffer, size, offset})
+#define zvm_pwrite64(desc, buffer, size, offset) \
+  TRAP64((uint64_t[]){TrapWrite64, 0, desc, (uintptr_t)buffer, size, offset})
 #define zvm_jail(buffer, size) \
   TRAP((uint64_t[]){TrapJail, 0, (uintptr_t)buffer, size})
 #define zvm_unjail(buffer, size) \
   TRAP((uint64_t[]){TrapUnjail, 0, (uintptr_t)buffer, size})
+#define zvm_release(buffer, size) \
+  TRAP((uint64_t[]){TrapRelease, 0, (uintptr_t)buffer, size})
 #define zvm_exit(code) TRAP((uint64_t[]){TrapExit, 0, code})
 #define zvm_fork() TRAP((uint64_t[]){TrapFork})
+#define zvm_poll(set, count, timeout) \
+  TRAP((uint64_t[]){TrapPoll, 0, (uintptr_t)set, count, timeout})
+#define zvm_thread(func, arg, stack, size) TRAP((uint64_t[]) \
+  {TrapThread, 0, (uintptr_t)func, (uint32_t)arg, (uintptr_t)stack, size})
+#define zvm_join(id) TRAP((uint64_t[]){TrapJoin, 0, id})
+#define zvm_spawn(count) TRAP((uint64_t[]){TrapSpawn, 0, count})
+#define zvm_wait(codes, count) \
+  TRAP((uint64_t[]){TrapWait, 0, (uintptr_t)codes, count})
+#define zvm_save() TRAP((uint64_t[]){TrapSave})
 
 #endif /* ZVM_API_H__ */
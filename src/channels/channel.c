@@ -15,6 +15,8 @@
  */
 
 #include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <glib.h>
 #include "src/loader/sel_ldr.h"
 #include "src/main/report.h"
@@ -26,10 +28,15 @@
 
 /*
  * array of read buffers. WARNING: buffers[0] should not be allocated
- * since it always will point to the user buffer for optimization reason
+ * since the 1st source always reads to the user buffer for optimization
+ * reason. only channels with several sources use the buffers, the
+ * buffers are shared between user threads and guarded by buffers_lock
  */
 static GPtrArray *buffers = NULL;
 static uint32_t buffers_size = 0; /* size of buffers */
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define POLL_SLICE 10 /* ms, the longest poll holding the channels locks */
 static GTree *aliases;
 static int tree_reset = 0;
 static uint32_t binds = 0; /* "bind" sources number */
@@ -51,22 +58,21 @@ static void ResetAliases()
   aliases = NULL;
 }
 
-/* get chunk of data from source. data will be put to "buffers" */
+/* get chunk of data from source "n" to "buf" */
 static int32_t GetDataChunk(struct ChannelDesc *channel, int n,
-    size_t size, off_t offset)
+    char *buf, size_t size, off_t offset)
 {
   int32_t result = 0;
 
   switch(CH_PROTO(channel, n))
   {
     case ProtoRegular:
-      result = pread(GPOINTER_TO_INT(CH_HANDLE(channel, n)),
-          buffers->pdata[n], size, offset);
+      result = pread(GPOINTER_TO_INT(CH_HANDLE(channel, n)), buf, size, offset);
       if(result == -1) result = -errno;
       break;
     case ProtoCharacter:
     case ProtoFIFO:
-      result = fread(buffers->pdata[n], 1, size, CH_HANDLE(channel, n));
+      result = fread(buf, 1, size, CH_HANDLE(channel, n));
       if(result == -1) result = -errno;
       break;
     case ProtoTCP:
@@ -81,7 +87,7 @@ static int32_t GetDataChunk(struct ChannelDesc *channel, int n,
       if(channel->eof == 0)
       {
         result = MIN(size, channel->bufend - channel->bufpos);
-        memcpy(buffers->pdata[n], MessageData(channel) + channel->bufpos, result);
+        memcpy(buf, MessageData(channel) + channel->bufpos, result);
         channel->bufpos += result;
       }
       break;
@@ -135,12 +141,25 @@ static int GetFirstSource(struct ChannelDesc *channel)
   return -1;
 }
 
-int32_t ChannelRead(struct ChannelDesc *channel,
+void UpdateChannelState(struct ChannelDesc *channel)
+{
+  struct ZVMChannelState *state = channel->state;
+
+  if(state == NULL) return;
+  state->getpos = channel->getpos;
+  state->putpos = channel->putpos;
+  state->size = channel->size;
+  state->eof = channel->eof;
+  memcpy(state->counters, channel->counters, sizeof state->counters);
+}
+
+int64_t ChannelRead(struct ChannelDesc *channel,
     char *buffer, size_t size, off_t offset)
 {
-  int32_t result = -1;
+  int64_t result = -1;
   int good = -1; /* index of buffer with proper data */
-  int readrest = size;
+  int64_t readrest = size;
+  int shared = channel->source->len > 1; /* "buffers" are needed */
   int toread;
   int n;
 
@@ -148,6 +167,10 @@ int32_t ChannelRead(struct ChannelDesc *channel,
   assert(channel != NULL);
   assert(channel->source->len > 0);
 
+  /* the 1st source reads to the user buffer ("zero copy") */
+#define CHUNK(n) ((n) == first ? buffer : (char*)buffers->pdata[n])
+  if(shared) pthread_mutex_lock(&buffers_lock);
+
   /* read "size" bytes or until channel EOF */
   while(readrest > 0 && !channel->eof)
   {
@@ -160,13 +183,10 @@ int32_t ChannelRead(struct ChannelDesc *channel,
     {
       int j;
 
-      /* choose "zero copy" source */
-      buffers->pdata[first] = buffer;
-
       /* get next data portion */
       if(!IS_VALID(CH_FILE(channel, n))) continue;
       SyncSource(channel, n);
-      result = GetDataChunk(channel, n, toread, offset);
+      result = GetDataChunk(channel, n, CHUNK(n), toread, offset);
       if(result < 0)
       {
         CH_FLAGS(channel, n) |= FLAG_VALID_MASK;
@@ -178,7 +198,7 @@ int32_t ChannelRead(struct ChannelDesc *channel,
       {
         /* skip invalid source buffer */
         if(!IS_VALID(CH_FILE(channel, n))) continue;
-        if(memcmp(buffers->pdata[j], buffers->pdata[n], result) == 0)
+        if(memcmp(CHUNK(j), CHUNK(n), result) == 0)
         {
           good = j;
           break;
@@ -197,7 +217,7 @@ int32_t ChannelRead(struct ChannelDesc *channel,
 
     /* copy verified data to buffer and shift the position */
     if(good > first)
-      memcpy(buffer, buffers->pdata[good], result);
+      memcpy(buffer, CHUNK(good), result);
     buffer += result;
     offset += result;
     readrest -= result;
@@ -207,6 +227,9 @@ int32_t ChannelRead(struct ChannelDesc *channel,
     channel->getpos = offset;
   }
 
+#undef CHUNK
+  if(shared) pthread_mutex_unlock(&buffers_lock);
+
   /* update tag and return actual data size */
   result = size - readrest;
   buffer -= result;
@@ -221,38 +244,57 @@ int32_t ChannelRead(struct ChannelDesc *channel,
   ++channel->counters[GetsLimit];
   if(result > 0)
     channel->counters[GetSizeLimit] += result;
+  UpdateChannelState(channel);
   return result;
 }
 
-int32_t ChannelWrite(struct ChannelDesc *channel,
+/* write the data chunk to the channel source "n" */
+static int32_t PutDataChunk(struct ChannelDesc *channel, int n,
+    const char *buffer, int32_t size, off_t offset)
+{
+  int32_t result = -1;
+
+  switch(CH_PROTO(channel, n))
+  {
+    case ProtoRegular:
+      result = pwrite(GPOINTER_TO_INT(CH_HANDLE(channel, n)), buffer, size, offset);
+      break;
+    case ProtoCharacter:
+    case ProtoFIFO:
+      result = fwrite(buffer, 1, size, CH_HANDLE(channel, n));
+      break;
+    case ProtoTCP:
+      result = SendData(channel, n, buffer, size);
+      break;
+    default: /* design error */
+      ZLOGFAIL(1, EFAULT, "invalid channel source %s;%d", channel->alias, n);
+      break;
+  }
+
+  /* accounting */
+  ZLOGFAIL(result < 0, EIO, "%s;%d failed to write: %s",
+      channel->alias, n, strerror(errno));
+  CountPut(CH_CONN(channel, n), result);
+  return result;
+}
+
+int64_t ChannelWrite(struct ChannelDesc *channel,
     const char *buffer, size_t size, off_t offset)
 {
   int n;
-  int32_t result = -1;
+  int64_t result = -1;
 
   for(n = 0; n < channel->source->len; ++n)
   {
-    switch(CH_PROTO(channel, n))
+    int32_t i = 0;
+
+    /* write the data by chunks until the source stops accepting it */
+    for(result = 0; result < (int64_t)size; result += i)
     {
-      case ProtoRegular:
-        result = pwrite(GPOINTER_TO_INT(CH_HANDLE(channel, n)), buffer, size, offset);
-        break;
-      case ProtoCharacter:
-      case ProtoFIFO:
-        result = fwrite(buffer, 1, size, CH_HANDLE(channel, n));
-        break;
-      case ProtoTCP:
-        result = SendData(channel, n, buffer, size);
-        break;
-      default: /* design error */
-        ZLOGFAIL(1, EFAULT, "invalid channel source %s;%d", channel->alias, n);
-        break;
+      i = MIN(size - result, WRITE_CHUNK_SIZE);
+      i = PutDataChunk(channel, n, buffer + result, i, offset + result);
+      if(i == 0) break;
     }
-
-    /* accounting */
-    ZLOGFAIL(result < 0, EIO, "%s;%d failed to write: %s",
-        channel->alias, n, strerror(errno));
-    CountPut(CH_CONN(channel, n), result);
   }
 
   /* update cursors and size */
@@ -266,9 +308,126 @@ int32_t ChannelWrite(struct ChannelDesc *channel,
   ++channel->counters[PutsLimit];
   if(result > 0)
     channel->counters[PutSizeLimit] += result;
+  UpdateChannelState(channel);
+  return result;
+}
+
+int ChannelsPoll(struct ChannelDesc **channels,
+    int8_t *ready, int count, int timeout)
+{
+  int i;
+  int j;
+  int result;
+  int *map = g_malloc(count * sizeof *map);
+  int *sources = g_malloc(count * sizeof *sources);
+  int8_t *state = g_malloc(count * sizeof *state);
+  struct ChannelDesc **locked = g_malloc(count * sizeof *locked);
+
+  /*
+   * channels used by other user threads are skipped. the sources are
+   * polled by short slices to not hold the channels locks for too long
+   */
+  for(;;)
+  {
+    int slice = timeout < 0 ? POLL_SLICE : MIN(timeout, POLL_SLICE);
+
+    /* file sources, buffered data, eof and broken channels are ready */
+    for(i = 0, j = 0, result = 0; i < count; ++i)
+    {
+      struct ChannelDesc *channel = channels[i];
+
+      ready[i] = 0;
+      if(pthread_mutex_trylock(&channel->lock) != 0) continue;
+
+      sources[j] = GetFirstSource(channel);
+      state[j] = sources[j] < 0 || channel->eof
+          || IS_FILE(CH_FILE(channel, sources[j]))
+          || channel->bufend - channel->bufpos > 0;
+      result += state[j];
+      locked[j] = channel;
+      map[j++] = i;
+    }
+
+    /* do not wait if some channels are already ready */
+    if(result > 0) slice = 0;
+    result = PollSources(locked, sources, state, j, slice);
+    if(j == 0) usleep(slice * 1000);
+
+    for(i = 0; i < j; ++i)
+    {
+      ready[map[i]] = state[i];
+      pthread_mutex_unlock(&locked[i]->lock);
+    }
+
+    if(result != 0 || timeout == slice) break;
+    if(timeout > 0) timeout -= slice;
+  }
+
+  g_free(locked);
+  g_free(state);
+  g_free(sources);
+  g_free(map);
   return result;
 }
 
+void ChannelsNetDetach(struct Manifest *manifest)
+{
+  int i;
+  int n;
+
+  assert(manifest != NULL);
+
+  for(i = 0; i < manifest->channels->len; ++i)
+  {
+    struct ChannelDesc *channel = CH_CH(manifest, i);
+    int network = 0;
+
+    for(n = channel->source->len - 1; n >= 0; --n)
+      if(IS_NETWORK(CH_CONN(channel, n)))
+      {
+        g_ptr_array_remove_index(channel->source, n);
+        network = 1;
+      }
+
+    /* the message belongs to the parent context */
+    if(network && channel->msg != NULL)
+    {
+      g_free(channel->msg);
+      channel->msg = NULL;
+    }
+  }
+
+  /* the parent session owns the network */
+  binds = 0;
+  connects = 0;
+  NetDetach();
+}
+
+void ChannelsDetach(struct Manifest *manifest, int index)
+{
+  int i;
+  int n;
+
+  assert(manifest != NULL);
+
+  /* network sockets belong to the parent session */
+  ChannelsNetDetach(manifest);
+  for(i = 0; i < manifest->channels->len; ++i)
+  {
+    struct ChannelDesc *channel = CH_CH(manifest, i);
+
+    for(n = channel->source->len - 1; n >= 0; --n)
+      if(!IS_RO(channel) && CH_PROTO(channel, n) == ProtoRegular)
+        PreloadChannelPrivate(channel, n, index);
+
+    /* shared streams cannot be read deterministically */
+    if(CH_SEQ_READABLE(channel) || channel->source->len == 0)
+      channel->eof = 1;
+    if(channel->source->len == 0)
+      channel->limits[PutsLimit] = channel->counters[PutsLimit];
+  }
+}
+
 /* get network sources statistics (RO - binds, WO - connects) */
 static void CountNetSources(const struct ChannelDesc *channel,
     uint32_t *binds_number, uint32_t *connects_number)
@@ -371,6 +530,7 @@ static void ChannelCtor(struct ChannelDesc *channel)
 
   /* check alias for duplicates and update the list */
   g_tree_insert(aliases, channel->alias, NULL);
+  pthread_mutex_init(&channel->lock, NULL);
 
   ZLOGFAIL(channel->type > RGetRPut, EFAULT,
       "%s has invalid type %d", channel->alias, channel->type);
@@ -402,9 +562,14 @@ static void ChannelDtor(struct ChannelDesc *channel)
   /* quit if channel isn't mounted (no handles added) */
   if(channel->source->len == 0) return;
 
-  /* free channel */
-  for(i = 0; i < channel->source->len; ++i)
-    if(IS_FILE(CH_FILE(channel, i)))
+  /*
+   * free channel. the sources are removed upon close, so the list is
+   * walked from the end. the shared sources are kept open for the daemon
+   */
+  for(i = channel->source->len - 1; i >= 0; --i)
+    if(IS_SHARED(CH_FILE(channel, i)))
+      continue;
+    else if(IS_FILE(CH_FILE(channel, i)))
       PreloadChannelDtor(channel, i);
     else
       PrefetchChannelDtor(channel, i);
@@ -414,6 +579,7 @@ static void ChannelDtor(struct ChannelDesc *channel)
    * since message can still be in use
    */
   FreeMessage(channel);
+  pthread_mutex_destroy(&channel->lock);
 }
 
 void ChannelsCtor(struct Manifest *manifest)
@@ -505,4 +671,6 @@ void ChannelsDtor(struct Manifest *manifest)
   /* release prefetch class */
   if(binds + connects > 0)
     NetDtor(manifest);
+  binds = 0;
+  connects = 0;
 }
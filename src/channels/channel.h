@@ -28,6 +28,9 @@ EXTERN_C_BEGIN
 
 /* net buffer size depends on it */
 #define BUFFER_SIZE 0x10000
+
+/* the largest portion of data passed to the source by the single call */
+#define WRITE_CHUNK_SIZE 0x40000000
 #ifndef UNIX_PATH_MAX
 #define UNIX_PATH_MAX 108
 #endif
@@ -39,10 +42,12 @@ EXTERN_C_BEGIN
 #define STDRAM "/dev/memory"
 
 #define FLAG_VALID_MASK 8
+#define FLAG_SHARED_MASK 16 /* the handle opened by the daemon */
 #define IS_NETWORK(c) ((c)->protocol < ProtoRegular)
 #define IS_FILE(c) (!IS_NETWORK(c))
 #define IS_IPHOST(c) ((c)->flags & 1)
 #define IS_VALID(c) (!((c)->flags & FLAG_VALID_MASK))
+#define IS_SHARED(c) ((c)->flags & FLAG_SHARED_MASK)
 
 /* CH_RW_TYPE returns 0..3 */
 #define IS_NIL(channel) (CH_RW_TYPE(channel) == 0)
@@ -78,14 +83,45 @@ void ChannelsCtor(struct Manifest *manifest);
 /* free channels resources */
 void ChannelsDtor(struct Manifest *manifest);
 
-/* read channel data through multiple sources */
-int32_t ChannelRead(struct ChannelDesc *channel,
+/*
+ * read channel data through multiple sources. "size" is not limited,
+ * the data is read by BUFFER_SIZE chunks
+ */
+int64_t ChannelRead(struct ChannelDesc *channel,
     char *buffer, size_t size, off_t offset);
 
-/* write channel data through multiple sources */
-int32_t ChannelWrite(struct ChannelDesc *channel,
+/*
+ * write channel data through multiple sources. "size" is not limited,
+ * the data is written by WRITE_CHUNK_SIZE chunks
+ */
+int64_t ChannelWrite(struct ChannelDesc *channel,
     const char *buffer, size_t size, off_t offset);
 
+/* copy channel positions, counters and eof to the user visible state */
+void UpdateChannelState(struct ChannelDesc *channel);
+
+/*
+ * wait up to "timeout" milliseconds (-1 - infinite) until at least one of
+ * given readable channels has data or eof pending. set "ready" flags for
+ * such channels. channels busy with other user threads are not ready.
+ * return number of ready channels or negative error code
+ */
+int ChannelsPoll(struct ChannelDesc **channels,
+    int8_t *ready, int count, int timeout);
+
+/*
+ * drop the network sources of the forked process. the sockets, messages
+ * and the network context belong to the parent. the sources are not freed
+ */
+void ChannelsNetDetach(struct Manifest *manifest);
+
+/*
+ * prepare the channels of the spawned session "index" (forked process).
+ * network sources are dropped, sequential readable channels are at eof,
+ * writable regular files become private. random read channels are shared
+ */
+void ChannelsDetach(struct Manifest *manifest, int index);
+
 EXTERN_C_END
 
 #endif /* CHANNEL_H_ */
@@ -28,6 +28,18 @@ void NetCtor(const struct Manifest *manifest);
 /* deallocate network context */
 void NetDtor(struct Manifest *manifest);
 
+/*
+ * forget the network context inherited by the forked process. the context
+ * (and its sockets) belongs to the parent and cannot be used or closed
+ */
+void NetDetach();
+
+/*
+ * prepare network context in advance (daemon spare child) and connect the
+ * write only sources with ip hosts. mounting takes the connected sources
+ */
+void NetPrepare(struct Manifest *manifest);
+
 /* construct network channel and connect/bind it to specified address */
 void PrefetchChannelCtor(struct ChannelDesc *channel, int n);
 
@@ -58,4 +70,13 @@ void FreeMessage(struct ChannelDesc *channel);
  */
 int32_t SendData(struct ChannelDesc *channel, int n, const char *buf, int32_t count);
 
+/*
+ * wait up to "timeout" milliseconds (-1 - infinite) for incoming messages on
+ * the network "sources" of given channels. channels already marked in "ready"
+ * are not polled, others will be marked if the message is pending
+ * return number of ready channels or negative error code
+ */
+int PollSources(struct ChannelDesc **channels,
+    const int *sources, int8_t *ready, int count, int timeout);
+
 #endif /* PREFETCH_H_ */
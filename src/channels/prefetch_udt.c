@@ -17,6 +17,7 @@
 #include <assert.h>
 #include <arpa/inet.h> /* convert ip <-> int */
 #include <netdb.h>
+#include <unistd.h>
 #include <udt/udtc.h>
 #include "src/channels/prefetch.h"
 #include "src/main/accounting.h"
@@ -25,6 +26,7 @@
 #define NET_BUFFER_SIZE BUFFER_SIZE
 #define ERROR(code) ZLOGIF(code, "failed: %s", udt_getlasterror_desc())
 #define MAX_CONN 1
+#define POLL_STEP 1000 /* microseconds between udt sources checks */
 
 /*
  * accept "bind" channels. since udt_accept() is a blocking thing
@@ -117,6 +119,18 @@ void NetDtor(struct Manifest *manifest)
   ZLOGFAIL(udt_cleanup() != 0, EFAULT, "udt: %s", udt_getlasterror_desc());
 }
 
+void NetDetach()
+{
+  /* udt library state cannot be dropped without the cleanup */
+  ZLOG(LOG_DEBUG, "NetDetach: udt");
+}
+
+void NetPrepare(struct Manifest *manifest)
+{
+  /* udt sources are connected upon mounting */
+  ZLOG(LOG_DEBUG, "NetPrepare: udt");
+}
+
 char *MessageData(struct ChannelDesc *channel)
 {
   ZLOG(LOG_DEBUG, "MessageData: %s", channel->alias);
@@ -191,6 +205,43 @@ int32_t SendData(struct ChannelDesc *channel, int n, const char *buf, int32_t co
   return count;
 }
 
+/* return non-zero if udt source has received data (or is broken) */
+static int SourceReady(struct ChannelDesc *channel, int n)
+{
+  int size = 0;
+  int len = sizeof size;
+
+  if(udt_getsockopt(GPOINTER_TO_INT(CH_HANDLE(channel, n)), 0,
+      UDT_UDT_RCVDATA, &size, &len) == UDT_ERROR) return 1;
+  return size > 0;
+}
+
+/*
+ * udt has no poll for the connected sockets in the c wrapper, so
+ * the sources are checked for received data until timeout expired
+ */
+int PollSources(struct ChannelDesc **channels,
+    const int *sources, int8_t *ready, int count, int timeout)
+{
+  int i;
+  int result;
+
+  for(;;)
+  {
+    for(result = 0, i = 0; i < count; ++i)
+    {
+      if(!ready[i]) ready[i] = SourceReady(channels[i], sources[i]);
+      result += ready[i];
+    }
+
+    if(result > 0 || timeout == 0) break;
+    usleep(POLL_STEP);
+    if(timeout > 0) timeout = MAX(0, timeout - POLL_STEP / 1000);
+  }
+
+  return result;
+}
+
 void SyncSource(struct ChannelDesc *channel, int n)
 {
   if(!CH_SEQ_READABLE(channel)) return;
@@ -198,16 +249,17 @@ void SyncSource(struct ChannelDesc *channel, int n)
   ZLOGS(LOG_INSANE, "SyncSource: %s;%d before skip pos = %ld, getpos = %ld",
       channel->alias, n, CH_CONN(channel, n)->pos, channel->getpos);
 
-  /* if source is a pipe read (*->getpos - *->pos) bytes */
+  /* if source is a pipe read (*->getpos - *->pos) bytes by buffers */
   if(CH_PROTO(channel, n) == ProtoFIFO || CH_PROTO(channel, n) == ProtoCharacter)
   {
-    int result;
+    size_t result;
     while(CH_CONN(channel, n)->pos < channel->getpos)
     {
       char buf[BUFFER_SIZE];
-      result = fread(buf, 1, channel->getpos - CH_CONN(channel, n)->pos,
-          CH_HANDLE(channel, n));
-      ZLOGFAIL(result < 0, EIO, "%s;%d: %s", channel->alias, n, strerror(errno));
+      result = fread(buf, 1, MIN(sizeof buf,
+          channel->getpos - CH_CONN(channel, n)->pos), CH_HANDLE(channel, n));
+      ZLOGFAIL(result == 0, EIO, "%s;%d: %s", channel->alias, n,
+          feof(CH_HANDLE(channel, n)) ? "unexpected eof" : strerror(errno));
       CH_CONN(channel, n)->pos += result;
     }
   }
@@ -31,6 +31,7 @@
 #undef X
 
 static void *context = NULL; /* zeromq context */
+static GPtrArray *prepared = NULL; /* (Connection*) connected in advance */
 
 /* return connection url. returned string must be freed with g_free */
 static char *MakeURL(struct ChannelDesc *channel, int n)
@@ -92,18 +93,95 @@ static void Connect(struct ChannelDesc *channel, int n)
   g_free(url);
 }
 
+/* take the source connected in advance. return 1 if found */
+static int TakePrepared(struct Connection *c)
+{
+  int i;
+
+  if(prepared == NULL) return 0;
+  for(i = 0; i < prepared->len; ++i)
+  {
+    struct Connection *p = g_ptr_array_index(prepared, i);
+
+    if(p->protocol != c->protocol || p->host != c->host
+        || p->port != c->port || !IS_IPHOST(c)) continue;
+
+    c->handle = p->handle;
+    g_free(p);
+    g_ptr_array_remove_index_fast(prepared, i);
+    return 1;
+  }
+  return 0;
+}
+
 void NetCtor(const struct Manifest *manifest)
 {
+  /* the context can be already prepared by the daemon spare child */
+  if(context != NULL) return;
+
   /* get zmq context */
   context = zmq_ctx_new();
   ZLOGFAIL(context == NULL, EFAULT, "cannot initialize zeromq context");
 }
 
+void NetDetach()
+{
+  context = NULL;
+  prepared = NULL;
+}
+
+void NetPrepare(struct Manifest *manifest)
+{
+  int i;
+  int j;
+
+  for(i = 0; i < manifest->channels->len; ++i)
+  {
+    struct ChannelDesc *channel = CH_CH(manifest, i);
+
+    for(j = 0; j < channel->source->len; ++j)
+    {
+      struct Connection *c = CH_CONN(channel, j);
+
+      if(!IS_NETWORK(c)) continue;
+      NetCtor(manifest);
+      if(!IS_WO(channel) || !IS_IPHOST(c)) continue;
+
+      /* connect the copy of the source, mounting will take it */
+      c = g_malloc(sizeof *c);
+      memcpy(c, CH_CONN(channel, j), sizeof *c);
+      c->handle = zmq_socket(context, ZMQ_PUSH);
+      ZLOGFAIL(c->handle == NULL, EFAULT,
+          "cannot get socket for %s;%d", channel->alias, j);
+      CH_HANDLE(channel, j) = c->handle;
+      Connect(channel, j);
+      CH_HANDLE(channel, j) = NULL;
+
+      if(prepared == NULL) prepared = g_ptr_array_new();
+      g_ptr_array_add(prepared, c);
+    }
+  }
+}
+
 void NetDtor(struct Manifest *manifest)
 {
   /* don't terminate if session is broken */
   if(GetExitCode() != 0) return;
 
+  /* close the sources connected in advance but not used */
+  if(prepared != NULL)
+  {
+    int i;
+    for(i = 0; i < prepared->len; ++i)
+    {
+      struct Connection *c = g_ptr_array_index(prepared, i);
+      ZMQ_ERR(zmq_close(c->handle));
+      g_free(c);
+    }
+    g_ptr_array_free(prepared, TRUE);
+    prepared = NULL;
+  }
+
   /*
    * it is possible to use zmq_term() from the old api, but i am not sure if it
    *  will work without hangups. note that zmq_ctx_term() is libzmq 4.0.1 only
@@ -196,6 +274,42 @@ int32_t SendData(struct ChannelDesc *channel, int n, const char *buf, int32_t co
   return count;
 }
 
+int PollSources(struct ChannelDesc **channels,
+    const int *sources, int8_t *ready, int count, int timeout)
+{
+  int i;
+  int j;
+  int result;
+  int *map = g_malloc(count * sizeof *map);
+  zmq_pollitem_t *items = g_malloc0(count * sizeof *items);
+
+  /* collect network sources of not yet ready channels */
+  for(i = 0, j = 0; i < count; ++i)
+  {
+    if(ready[i]) continue;
+    items[j].socket = CH_HANDLE(channels[i], sources[i]);
+    items[j].events = ZMQ_POLLIN;
+    map[j++] = i;
+  }
+
+  /* wait for messages and mark channels which have them */
+  ZLOGS(LOG_INSANE, "poll %d sources, timeout = %d", j, timeout);
+  result = j == 0 ? 0 : zmq_poll(items, j, timeout);
+  if(result < 0)
+    result = -zmq_errno();
+  else
+  {
+    for(i = 0; i < j; ++i)
+      if(items[i].revents & ZMQ_POLLIN) ready[map[i]] = 1;
+    for(result = 0, i = 0; i < count; ++i)
+      result += ready[i];
+  }
+
+  g_free(items);
+  g_free(map);
+  return result;
+}
+
 void SyncSource(struct ChannelDesc *channel, int n)
 {
   if(!CH_SEQ_READABLE(channel)) return;
@@ -203,16 +317,17 @@ void SyncSource(struct ChannelDesc *channel, int n)
   ZLOGS(LOG_INSANE, "%s;%d before skip pos = %ld, getpos = %ld",
       channel->alias, n, CH_CONN(channel, n)->pos, channel->getpos);
 
-  /* if source is a pipe read (*->getpos - *->pos) bytes */
+  /* if source is a pipe read (*->getpos - *->pos) bytes by buffers */
   if(CH_PROTO(channel, n) == ProtoFIFO || CH_PROTO(channel, n) == ProtoCharacter)
   {
-    int result;
+    size_t result;
     while(CH_CONN(channel, n)->pos < channel->getpos)
     {
       char buf[BUFFER_SIZE];
-      result = fread(buf, 1, channel->getpos - CH_CONN(channel, n)->pos,
-          CH_HANDLE(channel, n));
-      ZLOGFAIL(result < 0, EIO, "%s;%d: %s", channel->alias, n, strerror(errno));
+      result = fread(buf, 1, MIN(sizeof buf,
+          channel->getpos - CH_CONN(channel, n)->pos), CH_HANDLE(channel, n));
+      ZLOGFAIL(result == 0, EIO, "%s;%d: %s", channel->alias, n,
+          feof(CH_HANDLE(channel, n)) ? "unexpected eof" : strerror(errno));
       CH_CONN(channel, n)->pos += result;
     }
   }
@@ -255,11 +370,6 @@ void PrefetchChannelCtor(struct ChannelDesc *channel, int n)
   CH_FLAGS(channel, n) |= (CH_RW_TYPE(channel) - 1) << 1;
   sock_type = IS_RO(channel) ? ZMQ_PULL : ZMQ_PUSH;
 
-  /* open source (0mq socket) */
-  c->handle = zmq_socket(context, sock_type);
-  ZLOGFAIL(c->handle == NULL, EFAULT,
-      "cannot get socket for %s;%d", channel->alias, n);
-
   /* allocate one message per channel */
   if(channel->msg == NULL)
   {
@@ -267,6 +377,18 @@ void PrefetchChannelCtor(struct ChannelDesc *channel, int n)
     ZMQ_ERR(zmq_msg_init(channel->msg));
   }
 
+  /* the source connected in advance (see NetPrepare) */
+  if(sock_type == ZMQ_PUSH && TakePrepared(c))
+  {
+    ZLOGS(LOG_DEBUG, "%s;%d is already connected", channel->alias, n);
+    return;
+  }
+
+  /* open source (0mq socket) */
+  c->handle = zmq_socket(context, sock_type);
+  ZLOGFAIL(c->handle == NULL, EFAULT,
+      "cannot get socket for %s;%d", channel->alias, n);
+
   /* bind or connect the channel */
   sock_type == ZMQ_PULL ? Bind(channel, n) : Connect(channel, n);
 }
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 #include <assert.h>
+#include <sys/syscall.h>
 #include "src/channels/preload.h"
 
 #define CHANNEL_RIGHTS S_IRUSR | S_IWUSR
@@ -166,6 +167,71 @@ static void RegularChannel(struct ChannelDesc* channel, int n)
       errno, "%s open error", CH_NAME(channel, n));
 }
 
+/* copy "size" bytes of "from" to "to". return 0 if successful */
+static int CopyFile(int from, int to, int64_t size)
+{
+  loff_t in = 0;
+  loff_t out = 0;
+  ssize_t code = -1;
+  char *buf;
+
+#ifdef SYS_copy_file_range
+  /* in kernel copy (or reflink) if supported by the file system */
+  while(in < size)
+  {
+    code = syscall(SYS_copy_file_range, from, &in, to, &out, size - in, 0);
+    if(code <= 0) break;
+  }
+  if(in == size) return 0;
+  if(code == 0 || (errno != ENOSYS && errno != EXDEV && errno != EINVAL))
+    return -1;
+#endif
+
+  /* fallback */
+  buf = g_malloc(NACL_MAP_PAGESIZE);
+  while(in < size)
+  {
+    code = pread(from, buf, MIN(size - in, NACL_MAP_PAGESIZE), in);
+    if(code <= 0 || pwrite(to, buf, code, in) != code) break;
+    in += code;
+  }
+  g_free(buf);
+  return in == size ? 0 : -1;
+}
+
+void PreloadChannelPrivate(struct ChannelDesc *channel, int n, int index)
+{
+  int h;
+  char *name;
+
+  assert(channel != NULL);
+  assert(n < channel->source->len);
+  assert(CH_PROTO(channel, n) == ProtoRegular);
+
+  if(g_strcmp0(CH_NAME(channel, n), DEV_NULL) == 0) return;
+
+  /* the shared file is not closed for the other sessions */
+  name = g_strdup_printf("%s.%d", CH_NAME(channel, n), index);
+  h = open(name, (IS_WO(channel) ? O_WRONLY : O_RDWR) | O_CREAT | O_TRUNC,
+      CHANNEL_RIGHTS);
+  ZLOGFAIL(h < 0, errno, "cannot open %s", name);
+
+  /* r/w channel gets the parent content and positions (copy-on-write) */
+  if(!IS_WO(channel))
+    ZLOGFAIL(CopyFile(GPOINTER_TO_INT(CH_HANDLE(channel, n)), h,
+        channel->size) != 0, errno, "cannot copy %s to %s",
+        CH_NAME(channel, n), name);
+  close(GPOINTER_TO_INT(CH_HANDLE(channel, n)));
+  ZLOGS(LOG_DEBUG, "%s privatized to %s", channel->alias, name);
+
+  CH_HANDLE(channel, n) = GINT_TO_POINTER(h);
+  CH_NAME(channel, n) = name;
+  if(!IS_WO(channel)) return;
+  channel->size = 0;
+  channel->getpos = 0;
+  channel->putpos = 0;
+}
+
 void PreloadChannelCtor(struct ChannelDesc *channel, int n)
 {
   assert(channel != NULL);
@@ -175,6 +241,17 @@ void PreloadChannelCtor(struct ChannelDesc *channel, int n)
   ZLOGS(LOG_DEBUG, "mounting file %s to alias %s",
       CH_NAME(channel, n), channel->alias);
 
+  /* the read only source opened by the daemon (see daemon.c) */
+  if(IS_SHARED(CH_FILE(channel, n)))
+  {
+    struct stat fs;
+
+    ZLOGFAIL(fstat(GPOINTER_TO_INT(CH_HANDLE(channel, n)), &fs) != 0,
+        errno, "cannot stat %s", CH_NAME(channel, n));
+    channel->size = fs.st_size;
+    return;
+  }
+
   SetChannelSource(channel, n);
 
   switch(CH_PROTO(channel, n))
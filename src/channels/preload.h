@@ -34,4 +34,10 @@ void PreloadChannelCtor(struct ChannelDesc* channel, int n);
 /* (adjust and) close file associated with the channel */
 int PreloadChannelDtor(struct ChannelDesc* channel, int n);
 
+/*
+ * replace writable regular file source with the private (empty) file
+ * "name.index". used by the spawned sessions. /dev/null stays intact
+ */
+void PreloadChannelPrivate(struct ChannelDesc* channel, int n, int index);
+
 #endif
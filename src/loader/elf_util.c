@@ -340,6 +340,22 @@ void ElfImageLoad(const struct ElfImage *image,
 
     paddr = mem_start + php->p_vaddr;
 
+    /*
+     * read only data segments are mapped from the file (when possible).
+     * the tail of the last page must be zeroed like in the copied segment.
+     * not copied pages of the private mapping follow the file changes, so
+     * the text is always copied: it must not change after the validation
+     */
+    if((php->p_flags & (PF_W | PF_X)) == 0 && GioMmapFileMap(gp, (void*)paddr,
+        ROUNDUP_4K(php->p_filesz), (off_t)php->p_offset) == 0)
+    {
+      ZLOGS(LOG_INSANE, "Mapped %d (0x%x) bytes to address 0x%x",
+          php->p_filesz, php->p_filesz, paddr);
+      memset((void*)(paddr + php->p_filesz), 0,
+          ROUNDUP_4K(php->p_filesz) - php->p_filesz);
+      continue;
+    }
+
     ZLOGS(LOG_INSANE, "Seek to position %d (0x%x)", php->p_offset, php->p_offset);
 
     /*
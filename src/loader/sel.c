@@ -246,9 +246,75 @@ void AppLoadFile(struct Gio *gp, struct NaClApp *nap)
 
   ElfImageDelete(image);
 }
+
+void AppLoadImage(struct NaClApp *nap, int fd, off_t offset)
+{
+  size_t text;
+  size_t size;
+  void *p;
+  int err;
+
+  nap->stack_size = ROUNDUP_64K(nap->stack_size);
+  LogAddressSpaceLayout(nap);
+
+  ZLOGS(LOG_DEBUG, "Allocating address space");
+  AllocAddrSpace(nap);
+
+  /*
+   * the prepared text is read into the anonymous memory (executable pages
+   * must not be backed by the file), the rest is mapped copy-on-write
+   */
+  if(fd >= 0)
+  {
+    ZLOGS(LOG_DEBUG, "Mapping prepared image");
+    text = nap->static_text_end - NACL_TRAMPOLINE_END;
+    size = ROUNDUP_64K(nap->data_end) - nap->static_text_end;
+    if(text > 0)
+    {
+      p = (void*)(nap->mem_start + NACL_TRAMPOLINE_END);
+      ZLOGFAIL(mmap(p, text, PROT_READ | PROT_WRITE, MAP_PRIVATE
+          | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != p, errno,
+          "cannot allocate prepared text");
+      ZLOGFAIL(pread(fd, p, text, offset) != (ssize_t)text, EIO,
+          "cannot read prepared text");
+    }
+    if(size > 0)
+    {
+      p = mmap((void*)(nap->mem_start + nap->static_text_end), size,
+          PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset + text);
+      ZLOGFAIL(p == MAP_FAILED, errno, "cannot map prepared image");
+    }
+  }
+
+  /* the trampoline is specific for the zerovm instance */
+  err = NaCl_mprotect((void *)(nap->mem_start + NACL_TRAMPOLINE_START),
+      NACL_TRAMPOLINE_SIZE, PROT_READ | PROT_WRITE);
+  ZLOGFAIL(0 != err, EFAULT, "Failed to make trampoline writable. errno = %d", err);
+
+  ZLOGS(LOG_DEBUG, "Initializing arch switcher");
+  InitSwitchToApp(nap);
+
+  ZLOGS(LOG_DEBUG, "Installing trampoline");
+  LoadTrampoline(nap);
+
+  ZLOGS(LOG_DEBUG, "Applying memory protection");
+  MemoryProtection(nap);
+
+  ZLOGS(LOG_DEBUG, "AppLoadImage done");
+  LogAddressSpaceLayout(nap);
+}
 #undef DUMP
 
 NORETURN void CreateSession(struct NaClApp *nap)
+{
+  assert(nap != NULL);
+
+  /* note: nacl_sys->prog_ctr meaningless but should not be 0 */
+  ThreadContextCtor(nacl_sys, nap, 1, GetStackPtr());
+  RestartSession(nap);
+}
+
+NORETURN void RestartSession(struct NaClApp *nap)
 {
   uintptr_t stack_ptr;
 
@@ -261,12 +327,11 @@ NORETURN void CreateSession(struct NaClApp *nap)
   ((uint32_t*)stack_ptr)[4] = 1;
   ((uint32_t*)stack_ptr)[5] = 0xfffffff0;
 
-  /*
-   * construct "nacl_user" and "nacl_sys" globals
-   * note: nacl_sys->prog_ctr meaningless but should not be 0
-   */
+  /* construct "nacl_user" global */
   ThreadContextCtor(nacl_user, nap, nap->initial_entry_pt, stack_ptr);
-  ThreadContextCtor(nacl_sys, nap, 1, GetStackPtr());
+
+  /* the initial thread gets the parameters block */
+  nacl_user->rdi = NaClSysToUser(nap, stack_ptr + sizeof(uint64_t));
 
   /* pass control to the user side */
   ZLOGS(LOG_DEBUG, "SESSION %d STARTED", nap->manifest->node);
@@ -23,9 +23,11 @@
 #include <sys/mman.h>
 #include "src/loader/sel_ldr.h"
 #include "src/platform/sel_memory.h"
+#include "src/main/setup.h"
 
-/* user memory size (84gb) */
-static size_t request_sz = 0;
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
 
 /* protect bumpers (guarding space) */
 static void MprotectGuards(struct NaClApp *nap)
@@ -52,21 +54,31 @@ static void MprotectGuards(struct NaClApp *nap)
 }
 
 /*
- * allocate a large amount of memory of mem_sz bytes that must
- * be address aligned
+ * allocate mem_sz bytes in the first free sandbox slot. the occupied slot
+ * fails with MAP_FIXED_NOREPLACE (the mapped memory is not clobbered).
+ * old kernels ignore the flag and take the slot address as a hint, so the
+ * result is checked anyway. returns the slot start
  */
-static void AllocatePow2AlignedMemory(size_t mem_sz)
+static void *AllocateSlot(size_t mem_sz)
 {
+  int i;
+  void *hint;
   void *mem_ptr;
 
   assert(mem_sz % NACL_MAP_PAGESIZE == 0);
+  ZLOGS(LOG_INSANE, "%25s %016lx", " Ask:", mem_sz);
 
-  request_sz = mem_sz;
-  ZLOGS(LOG_INSANE, "%25s %016lx", " Ask:", request_sz);
+  for(i = 0; i < SANDBOX_SLOTS; ++i)
+  {
+    hint = (void*)(SANDBOX_BASE + i * SANDBOX_SPAN);
+    mem_ptr = mmap(hint, mem_sz, PROT_NONE,
+        RELATIVE_MMAP | MAP_FIXED_NOREPLACE, -1, (off_t)0);
+    if(mem_ptr == hint) return mem_ptr;
+    if(mem_ptr != MAP_FAILED) munmap(mem_ptr, mem_sz);
+  }
 
-  /* d'b: try to get the fixed address r15 (user base register) */
-  mem_ptr = mmap(R15_CONST, request_sz, PROT_NONE, ABSOLUTE_MMAP, -1, (off_t)0);
-  ZLOGFAIL(R15_CONST != mem_ptr, errno, "cannot allocate user memory");
+  ZLOGFAIL(1, ENOMEM, "cannot allocate user memory");
+  return NULL;
 }
 
 /*
@@ -90,22 +102,22 @@ static void AllocateSpace(void **mem, size_t addrsp_size)
 
   /* 4gb + 40gb guard on each side */
   ZLOGS(LOG_INSANE, "AllocateSpace(*, 0x%016lx bytes)", addrsp_size);
-  AllocatePow2AlignedMemory(2 * GUARDSIZE + FOURGIG);
 
   /*
    * The module lives in the middle FOURGIG of the allocated region --
    * we skip over an initial 40G guard.
    */
-  *mem = (char*)R15_CONST + GUARDSIZE;
+  *mem = (char*)AllocateSlot(SANDBOX_SPAN) + GUARDSIZE;
   ZLOGS(LOG_INSANE, "addr space at 0x%016lx", (uintptr_t)*mem);
 }
 
 void FreeAddrSpace(struct NaClApp *nap)
 {
   /* exit if memory was not allocated */
-  if(request_sz == 0) return;
-  ZLOGIF(munmap(R15_CONST, request_sz) == -1,
+  if(nap->mem_start == 0) return;
+  ZLOGIF(munmap((void*)(nap->mem_start - GUARDSIZE), SANDBOX_SPAN) == -1,
       "user memory deallocation failed with errno %d", errno);
+  nap->mem_start = 0;
 }
 
 void AllocAddrSpace(struct NaClApp *nap)
@@ -120,6 +132,7 @@ void AllocAddrSpace(struct NaClApp *nap)
 
   nap->mem_start = (uintptr_t) mem;
   ZLOGS(LOG_INSANE, "allocated memory at 0x%08x", nap->mem_start);
+  SetMemoryPolicy(nap);
 
   hole_start = ROUNDUP_64K(nap->data_end);
 
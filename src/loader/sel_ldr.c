@@ -208,6 +208,10 @@ static void FillTrampolineRegion(struct NaClApp *nap)
     ((void *)(nap->mem_start + NACL_TRAMPOLINE_START), NACL_TRAMPOLINE_SIZE);
 }
 
+__thread struct ThreadContext *nacl_user = NULL;
+__thread struct ThreadContext *nacl_sys = NULL;
+struct NaClApp *gnap = NULL;
+
 void NaClAppCtor(struct NaClApp *nap)
 {
   nap->addr_bits = NACL_MAX_ADDR_BITS;
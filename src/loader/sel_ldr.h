@@ -156,10 +156,10 @@ struct NaClApp {
   struct Manifest           *manifest;
 };
 
-/* global variables */
-struct ThreadContext    *nacl_user; /* user registers storage */
-struct ThreadContext    *nacl_sys;  /* zerovm registers storage */
-struct NaClApp              *gnap;      /* pointer to global NaClApp object */
+/* global variables. registers storages are per user thread */
+extern __thread struct ThreadContext *nacl_user; /* user registers storage */
+extern __thread struct ThreadContext *nacl_sys;  /* zerovm registers storage */
+extern struct NaClApp *gnap; /* pointer to global NaClApp object */
 
 /*
  * Initializes a NaCl application with the default parameters.
@@ -191,6 +191,14 @@ void NaClAppDtor(struct NaClApp *nap);
  */
 void AppLoadFile(struct Gio *gp, struct NaClApp *nap);
 
+/*
+ * load the program prepared before: the layout fields of "nap" must be
+ * restored, "fd" at "offset" holds the loaded (and validated) pages from
+ * NACL_TRAMPOLINE_END to the end of data. if "fd" is negative the pages
+ * are left zeroed (the caller fills them)
+ */
+void AppLoadImage(struct NaClApp *nap, int fd, off_t offset);
+
 /* TODO(d'b): replace spaces with format options and use macro */
 void PrintAppDetails(struct NaClApp *nap, int verbosity);
 
@@ -200,6 +208,12 @@ void PrintAppDetails(struct NaClApp *nap, int verbosity);
  */
 void CreateSession(struct NaClApp *nap);
 
+/*
+ * start the program again from the entry point with an empty user stack.
+ * the trusted context set by CreateSession() is kept (recycling)
+ */
+void RestartSession(struct NaClApp *nap);
+
 /*
  * Install syscall trampolines at all possible well-formed entry points
  * within the trampoline pages.  Many of these syscalls will correspond
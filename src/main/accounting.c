@@ -26,6 +26,10 @@ static int64_t network_stats[LimitsNumber] = {0};
 static int64_t local_stats[LimitsNumber] = {0};
 static float user_time = 0;
 static float sys_time = 0;
+static float user_base = 0; /* cpu time before the accounting reset */
+static float sys_base = 0;
+static int64_t huge_pages = 0; /* user memory backed by huge pages */
+static int64_t queue_time = 0; /* daemon request waiting time (usec) */
 
 /* count i/o statistics */
 static void CountBytes(struct Connection *c, int size, int index)
@@ -35,10 +39,10 @@ static void CountBytes(struct Connection *c, int size, int index)
   assert(c != NULL);
   assert(size >= 0);
 
-  /* update statistics */
+  /* update statistics (user threads can do i/o simultaneously) */
   acc = IS_FILE(c) ? local_stats : network_stats;
-  acc[index + 1] += size;
-  ++acc[index];
+  __sync_fetch_and_add(&acc[index + 1], size);
+  __sync_fetch_and_add(&acc[index], 1);
 }
 
 void CountGet(struct Connection *c, int size)
@@ -68,22 +72,49 @@ static void SystemAccounting()
   ZLOGIF(code != 4, "error %d occurred while reading '%s'", errno, path);
 
   /* set I/O and CPU time */
-  sys_time = (t[1] + t[3]) / ticks;
-  user_time = (t[0] + t[2]) / ticks;
+  sys_time = (t[1] + t[3]) / ticks - sys_base;
+  user_time = (t[0] + t[2]) / ticks - user_base;
   g_free(path);
   fclose(f);
 }
 
+/* get amount of the user memory backed by huge pages */
+static void HugePagesAccounting()
+{
+  FILE *f;
+  char line[BIG_ENOUGH_STRING];
+  uintptr_t start, end;
+  int user = 0;
+  int64_t kb;
+
+  huge_pages = 0;
+  if(gnap == NULL || gnap->mem_start == 0) return;
+
+  f = fopen("/proc/self/smaps", "r");
+  if(f == NULL) return;
+
+  /* sum "AnonHugePages" of the areas inside the user space */
+  while(fgets(line, sizeof line, f) != NULL)
+  {
+    if(sscanf(line, "%lx-%lx ", &start, &end) == 2)
+      user = start >= gnap->mem_start && end <= gnap->mem_start + FOURGIG;
+    else if(user && sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+      huge_pages += kb * 1024;
+  }
+  fclose(f);
+}
+
 /* returns string i/o statistics */
 static char *Accounting(int fast)
 {
-  return g_strdup_printf("%.2f %.2f %ld %ld %ld %ld %ld %ld %ld %ld",
+  return g_strdup_printf("%.2f %.2f %ld %ld %ld %ld %ld %ld %ld %ld %ld %.6f",
       fast ? 0 : sys_time /* TODO(d'b): put I/O time instead of 0 */,
       fast ? clock() / (float)CLOCKS_PER_SEC : user_time,
       local_stats[GetsLimit], local_stats[GetSizeLimit],
       local_stats[PutsLimit], local_stats[PutSizeLimit],
       network_stats[GetsLimit], network_stats[GetSizeLimit],
-      network_stats[PutsLimit], network_stats[PutSizeLimit]);
+      network_stats[PutsLimit], network_stats[PutSizeLimit],
+      fast ? 0 : huge_pages, queue_time / (double)MICRO_PER_SEC);
 }
 
 char *FastAccounting()
@@ -94,6 +125,7 @@ char *FastAccounting()
 char *FinalAccounting()
 {
   SystemAccounting();
+  HugePagesAccounting();
   return Accounting(0);
 }
 
@@ -101,4 +133,17 @@ void ResetAccounting()
 {
   memset(network_stats, 0, sizeof network_stats);
   memset(local_stats, 0, sizeof network_stats);
+  queue_time = 0;
+
+  /* the recycled session is charged only for own cpu time */
+  sys_base = 0;
+  user_base = 0;
+  SystemAccounting();
+  sys_base = sys_time;
+  user_base = user_time;
+}
+
+void SetQueueTime(int64_t usec)
+{
+  queue_time = usec;
 }
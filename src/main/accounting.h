@@ -43,4 +43,7 @@ char *FinalAccounting();
 /* reset accounting internals */
 void ResetAccounting();
 
+/* set the time the daemon request waited for the session start */
+void SetQueueTime(int64_t usec);
+
 #endif /* ACCOUNTING_H_ */
@@ -131,11 +131,11 @@
 /* d'b: macro definitions for the user space allocation */
 #define FOURGIG     (((size_t) 1) << 32)
 #define GUARDSIZE   (10 * FOURGIG)
-#define R15_CONST   ((void*)0x440000000000)
+#define SANDBOX_SPAN (FOURGIG + 2 * GUARDSIZE) /* user space with bumpers */
+#define SANDBOX_BASE ((uintptr_t)0x440000000000) /* the preferred slot */
+#define SANDBOX_SLOTS 512 /* the last slot ends below 128tb */
 #define RELATIVE_MMAP (MAP_ANONYMOUS | MAP_NORESERVE | MAP_PRIVATE)
 #define ABSOLUTE_MMAP (RELATIVE_MMAP | MAP_FIXED)
-#define START_OF_USER_SPACE ((uintptr_t)R15_CONST)
-#define END_OF_USER_SPACE (START_OF_USER_SPACE + FOURGIG + 2 * GUARDSIZE)
 #define LEAST_USER_HEAP_SIZE (8*1024*1024)
 
 #endif  /* CONFIG_H_ */
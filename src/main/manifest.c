@@ -25,6 +25,7 @@
  */
 #include <assert.h>
 #include <arpa/inet.h> /* convert ip to int */
+#include <linux/mempolicy.h>
 #include "src/main/manifest.h"
 #include "src/channels/channel.h"
 
@@ -43,6 +44,13 @@
 #define VALUE_DELIMITER ","
 #define TOKEN_DELIMITER ";"
 #define CONNECTION_DELIMITER ":"
+#define RANGE_DELIMITER "-"
+
+/* maximum numa node number + 1 */
+#define NUMA_NODES_LIMIT 64
+
+/* maximum daemon pre-forked children number */
+#define POOL_LIMIT 0x400
 
 #define XARRAY(a) static char *ARRAY_##a[] = {a};
 #define X(a) #a,
@@ -94,7 +102,19 @@ typedef enum {
   X(NameServer, 0, 1) \
   X(Node, 0, 1) \
   X(Job, 0, 1) \
-  X(Etag, 0, 1)
+  X(Etag, 0, 1) \
+  X(HugePages, 0, 1) \
+  X(Prefault, 0, 1) \
+  X(CpuSet, 0, 1) \
+  X(NumaNode, 0, 1) \
+  X(MemPolicy, 0, 1) \
+  X(Save, 0, 1) \
+  X(Checkpoint, 0, 1) \
+  X(Pool, 0, 1) \
+  X(Sessions, 0, 1) \
+  X(Shared, 0, 1) \
+  X(Warm, 0, 1) \
+  X(Recycle, 0, 1)
 
 /* (x-macro): manifest enumeration, array and statistics */
 #define XENUM(a) enum ENUM_##a {a};
@@ -209,6 +229,137 @@ static void Etag(struct Manifest *manifest, char *value)
   manifest->etag = g_strdup(g_strstrip(value));
 }
 
+/* set huge_pages field */
+static void HugePages(struct Manifest *manifest, char *value)
+{
+  int64_t huge_pages = ToInt(value);
+
+  MFTFAIL(huge_pages < 0 || huge_pages > 2, EFAULT, "invalid huge pages token");
+  manifest->huge_pages = huge_pages;
+}
+
+/* set prefault field */
+static void Prefault(struct Manifest *manifest, char *value)
+{
+  int64_t prefault = ToInt(value);
+
+  MFTFAIL(prefault < 0 || prefault > 2, EFAULT, "invalid prefault token");
+  manifest->prefault = prefault;
+}
+
+/*
+ * parse list of numbers and ranges (e.g. "0-3, 6") and set
+ * appropriate "flags" elements. numbers should be less than "limit"
+ */
+static void ParseList(char *value, uint8_t *flags, int limit)
+{
+  char **tokens;
+  int i;
+
+  tokens = g_strsplit(value, VALUE_DELIMITER, limit);
+  for(i = 0; tokens[i] != NULL; ++i)
+  {
+    int64_t first;
+    int64_t last;
+    char **range = g_strsplit(tokens[i], RANGE_DELIMITER, 3);
+
+    MFTFAIL(range[0] == NULL || (range[1] != NULL && range[2] != NULL),
+        EFAULT, "invalid list token");
+    first = ToInt(range[0]);
+    last = range[1] == NULL ? first : ToInt(range[1]);
+    MFTFAIL(first < 0 || last < first || last >= limit,
+        EFAULT, "invalid list range");
+
+    while(first <= last)
+      flags[first++] = 1;
+    g_strfreev(range);
+  }
+  g_strfreev(tokens);
+}
+
+/* set cpus field */
+static void CpuSet(struct Manifest *manifest, char *value)
+{
+  uint8_t flags[CPU_SETSIZE] = {0};
+  int i;
+
+  ParseList(value, flags, CPU_SETSIZE);
+  manifest->cpus = g_malloc0(sizeof *manifest->cpus);
+  for(i = 0; i < CPU_SETSIZE; ++i)
+    if(flags[i]) CPU_SET(i, manifest->cpus);
+}
+
+/* set numa_nodes field */
+static void NumaNode(struct Manifest *manifest, char *value)
+{
+  uint8_t flags[NUMA_NODES_LIMIT] = {0};
+  int i;
+
+  ParseList(value, flags, NUMA_NODES_LIMIT);
+  for(i = 0; i < NUMA_NODES_LIMIT; ++i)
+    if(flags[i]) manifest->numa_nodes |= 1LLU << i;
+}
+
+/* set mem_policy field */
+static void MemPolicy(struct Manifest *manifest, char *value)
+{
+  char *policies[] = {"bind", "preferred", "interleave"};
+  int modes[] = {MPOL_BIND, MPOL_PREFERRED, MPOL_INTERLEAVE};
+  int i;
+
+  value = g_strstrip(value);
+  for(i = 0; i < ARRAY_SIZE(policies); ++i)
+    if(g_strcmp0(policies[i], value) == 0) break;
+
+  MFTFAIL(i == ARRAY_SIZE(policies), EFAULT, "invalid memory policy");
+  manifest->mem_policy = modes[i];
+}
+
+/* set save field (should be g_free later) */
+static void Save(struct Manifest *manifest, char *value)
+{
+  manifest->save = g_strdup(g_strstrip(value));
+}
+
+/* set the checkpoints interval (seconds) */
+static void Checkpoint(struct Manifest *manifest, char *value)
+{
+  int64_t interval = ToInt(value);
+
+  MFTFAIL(interval < 1 || interval > G_MAXINT32, EFAULT,
+      "invalid Checkpoint interval");
+  manifest->checkpoint = interval;
+}
+
+/* set the daemon pre-forked children number */
+static void Pool(struct Manifest *manifest, char *value)
+{
+  int64_t pool = ToInt(value);
+
+  MFTFAIL(pool < 0 || pool > POOL_LIMIT, EFAULT, "invalid Pool size");
+  manifest->pool = pool;
+}
+
+/* set the daemon concurrently running sessions limit */
+static void Sessions(struct Manifest *manifest, char *value)
+{
+  int64_t sessions = ToInt(value);
+
+  MFTFAIL(sessions < 0 || sessions > G_MAXINT32, EFAULT,
+      "invalid Sessions limit");
+  manifest->sessions = sessions;
+}
+
+/* set the daemon shared channels aliases (should be g_strfreev later) */
+static void Shared(struct Manifest *manifest, char *value)
+{
+  int i;
+
+  manifest->shared = g_strsplit(value, VALUE_DELIMITER, MANIFEST_TOKENS_LIMIT);
+  for(i = 0; manifest->shared[i] != NULL; ++i)
+    g_strstrip(manifest->shared[i]);
+}
+
 /* convert ip address (or node id) to integer */
 static uint32_t ExtractHost(char *host, uint8_t *flags)
 {
@@ -273,6 +424,8 @@ static void ParseName(char *name, GPtrArray *names)
     c->protocol = proto;
     c->host = ExtractHost(tokens[Host], &c->flags);
     c->port = ToInt(tokens[Port]);
+    c->mft_host = c->host;
+    c->mft_port = c->port;
     c->handle = NULL;
     g_ptr_array_add(names, c);
   }
@@ -280,6 +433,11 @@ static void ParseName(char *name, GPtrArray *names)
   g_strfreev(tokens);
 }
 
+void ManifestSourceCtor(GPtrArray *sources, char *name)
+{
+  ParseName(name, sources);
+}
+
 /* TODO(d'b): it is ugly. solution needed */
 static void NameServer(struct Manifest *manifest, char *value)
 {
@@ -349,6 +507,24 @@ static void CheckCounters(int *counters, int n)
   }
 }
 
+/* set the daemon warm mode: 1 - the daemon is started before the program */
+static void Warm(struct Manifest *manifest, char *value)
+{
+  int64_t warm = ToInt(value);
+
+  MFTFAIL(warm < 0 || warm > 1, EFAULT, "invalid Warm value");
+  manifest->warm = warm;
+}
+
+/* set the session recycling: 1 - the sessions are served by one process */
+static void Recycle(struct Manifest *manifest, char *value)
+{
+  int64_t recycle = ToInt(value);
+
+  MFTFAIL(recycle < 0 || recycle > 1, EFAULT, "invalid Recycle value");
+  manifest->recycle = recycle;
+}
+
 struct Manifest *ManifestTextCtor(char *text)
 {
   struct Manifest *manifest = g_malloc0(sizeof *manifest);
@@ -385,6 +561,27 @@ struct Manifest *ManifestTextCtor(char *text)
   g_strfreev(lines);
   CheckCounters(counters, XSIZE(KEYWORDS));
 
+  /* memory policy is applied to the given numa nodes */
+  ZLOGFAIL(manifest->mem_policy != MPOL_DEFAULT && manifest->numa_nodes == 0,
+      EFAULT, "MemPolicy requires NumaNode");
+  ZLOGFAIL(manifest->mem_policy == MPOL_PREFERRED
+      && (manifest->numa_nodes & (manifest->numa_nodes - 1)) != 0,
+      EFAULT, "preferred MemPolicy requires the single NumaNode");
+  if(manifest->mem_policy == MPOL_DEFAULT && manifest->numa_nodes != 0)
+    manifest->mem_policy = MPOL_BIND;
+
+  /* the checkpoints are written to the session image */
+  ZLOGFAIL(manifest->checkpoint != 0 && manifest->save == NULL,
+      EFAULT, "Checkpoint requires Save");
+
+  /* the warm daemon listens to the job socket */
+  ZLOGFAIL(manifest->warm != 0 && manifest->job == NULL,
+      EFAULT, "Warm requires Job");
+  ZLOGFAIL(manifest->recycle != 0 && manifest->job == NULL,
+      EFAULT, "Recycle requires Job");
+  ZLOGFAIL(manifest->recycle != 0 && manifest->warm != 0,
+      EFAULT, "Recycle cannot be Warm");
+
   return manifest;
 }
 
@@ -427,5 +624,8 @@ void ManifestDtor(struct Manifest *manifest)
   TagDtor(manifest->mem_tag);
   g_free(manifest->name_server);
   g_free(manifest->program);
+  g_free(manifest->save);
+  g_strfreev(manifest->shared);
+  g_free(manifest->cpus);
   g_free(manifest);
 }
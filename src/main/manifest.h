@@ -19,6 +19,8 @@
 #ifndef MANIFEST_H__
 #define MANIFEST_H__ 1
 
+#include <sched.h>
+#include <pthread.h>
 #include "api/zvm.h"
 #include "src/loader/sel_ldr.h"
 #include "src/main/tools.h"
@@ -67,6 +69,8 @@ struct Connection {
   uint16_t port;
   uint32_t host;
   void *backup; /* for udt it is stored original handle */
+  uint16_t mft_port; /* port as specified in manifest */
+  uint32_t mft_host; /* host (node or ip) as specified in manifest */
 };
 
 /* local channel description */
@@ -96,6 +100,8 @@ struct ChannelDesc {
   int32_t bufpos; /* index of the 1st available byte in the buffer */
   int32_t bufend; /* index of the 1st unavailable byte in the buffer */
   int64_t counters[LimitsNumber];
+  struct ZVMChannelState *state; /* trusted alias of the user visible state */
+  pthread_mutex_t lock; /* serializes the channel i/o of user threads */
 };
 
 /* zerovm manifest structure */
@@ -104,8 +110,20 @@ struct Manifest {
   char *program; /* program file name */
   char *etag; /* signature. reserved for a future */
   char *job; /* daemon: job file name. child: manifest file name */
+  int32_t pool; /* daemon: pre-forked children number */
+  int32_t sessions; /* daemon: running sessions limit or 0 */
+  char **shared; /* daemon: aliases of channels kept open or NULL */
+  int8_t warm; /* daemon: 1 - started before the program (no zvm_fork) */
+  int8_t recycle; /* 1 - the process serves the "job" requests in turn */
+  char *save; /* session image file name or NULL */
+  int32_t checkpoint; /* checkpoints interval in seconds or 0 */
   int32_t timeout; /* time user module allowed to run */
   int64_t mem_size; /* user specified memory */
+  int8_t huge_pages; /* 0 - disabled, 1 - heap, 2 - heap and text */
+  int8_t prefault; /* 0 - disabled, 1 - in place, 2 - by helper thread */
+  cpu_set_t *cpus; /* cpus allowed for zerovm or NULL */
+  uint64_t numa_nodes; /* memory nodes of the user space or 0 */
+  int mem_policy; /* MPOL_* for "numa_nodes" */
   void *mem_tag; /* tag context */
   struct Connection *name_server;
   GPtrArray *channels; /* all elements are (ChannelDesc*) */
@@ -117,6 +135,9 @@ struct Manifest *ManifestCtor(const char *name);
 /* de-serialize manifest from the given text */
 struct Manifest *ManifestTextCtor(char *text);
 
+/* parse the channel source "name" (path or url) and append it to "sources" */
+void ManifestSourceCtor(GPtrArray *sources, char *name);
+
 /*
  * release manifest resources. all elements initialized by another classes
  * must be deallocated by those classes
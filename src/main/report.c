@@ -22,6 +22,7 @@
 #include "src/main/accounting.h"
 #include "src/main/setup.h"
 #include "src/channels/channel.h"
+#include "src/syscalls/spawn.h"
 
 #define QUANT MICRO_PER_SEC
 
@@ -249,7 +250,6 @@ void Report(struct NaClApp *nap)
   g_string_truncate(r, r->len - 1);
 
   /* report accounting and session message */
-  if(zvm_state == NULL) zvm_state = UNKNOWN_STATE;
   REPORT(r, "%s%s%s%s", eol, REPORT_ACCOUNTING, acc, eol);
   REPORT(r, "%s%s%s", REPORT_STATE,
       zvm_state == NULL ? UNKNOWN_STATE : zvm_state, eol);
@@ -260,6 +260,20 @@ void Report(struct NaClApp *nap)
   g_free(acc);
 }
 
+void ReportSession(struct NaClApp *nap)
+{
+  ChannelsDtor(nap->manifest);
+  ZTrace("[channels destruction]");
+  Report(nap);
+  ZTrace("[report]");
+
+  /* the next session starts with the clean report */
+  g_string_truncate(digests, 0);
+  g_free(zvm_state);
+  zvm_state = NULL;
+  user_code = 0;
+}
+
 void ReportDtor(int zvm_ret)
 {
   SetExitCode(zvm_ret);
@@ -274,6 +288,8 @@ void ReportDtor(int zvm_ret)
     ZTrace("[final dump]");
   }
 
+  /* not waited spawned sessions do not survive the parent */
+  SpawnDtor();
   ChannelsDtor(gnap->manifest);
   ZTrace("[channels destruction]");
   Report(gnap);
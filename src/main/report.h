@@ -71,6 +71,9 @@ void FastReport();
 /* full report (declared for daemon) */
 void Report(struct NaClApp *nap);
 
+/* report the session without exit (recycling), then reset the report */
+void ReportSession(struct NaClApp *nap);
+
 /*
  * exit zerovm. if code != 0 log it and show dump. release resources
  * note: use global nap because can be invoked from signal handler
@@ -17,7 +17,10 @@
  * limitations under the License.
  */
 #include <assert.h>
+#include <pthread.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #include <sys/mman.h>
 #include "src/loader/sel_ldr.h"
 #include "src/platform/sel_memory.h"
@@ -102,6 +105,29 @@ static void SetTimeout(struct Manifest *manifest)
   alarm(manifest->timeout);
 }
 
+/* bind zerovm (and the user threads) to the manifest cpus */
+static void SetAffinity(struct Manifest *manifest)
+{
+  if(manifest->cpus == NULL) return;
+  ZLOGFAIL(sched_setaffinity(0, sizeof *manifest->cpus, manifest->cpus) != 0,
+      errno, "cannot set cpu affinity");
+}
+
+void SetMemoryPolicy(struct NaClApp *nap)
+{
+  int code;
+  struct Manifest *manifest = nap->manifest;
+
+  assert(manifest != NULL);
+
+  if(manifest->numa_nodes == 0) return;
+
+  /* the user space is not populated yet, all pages will obey the policy */
+  code = syscall(SYS_mbind, nap->mem_start, FOURGIG, manifest->mem_policy,
+      &manifest->numa_nodes, 8 * sizeof manifest->numa_nodes + 1, 0);
+  ZLOGFAIL(code != 0, errno, "cannot set memory policy");
+}
+
 /* lower zerovm priority */
 static void LowerOwnPriority()
 {
@@ -121,10 +147,81 @@ static void GiveUpPrivileges()
 void LastDefenseLine(struct Manifest *manifest)
 {
   SetTimeout(manifest);
+  SetAffinity(manifest);
   LowerOwnPriority();
   GiveUpPrivileges();
 }
 
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+static pthread_t prefault_thread;
+static int prefault_started = 0;
+static struct MemBlock prefault_area[2]; /* heap and stack bounds */
+
+/* fault in the pages of the area keeping its content */
+static void Populate(uintptr_t area, int64_t size)
+{
+  uintptr_t p;
+
+  if(size <= 0) return;
+  if(NaCl_madvise((void*)area, size, MADV_POPULATE_WRITE) == 0) return;
+
+  /* old kernels: touch each page. atomic since the area can be in use */
+  for(p = area; p < area + size; p += NACL_PAGESIZE)
+    __sync_fetch_and_add((char*)p, 0);
+}
+
+/*
+ * populate data, heap and stack. the thread only uses the bounds copied
+ * before its start: mem_map is changed by the main thread meanwhile
+ */
+static void *PrefaultMain(void *arg)
+{
+  struct MemBlock *area = arg;
+
+  Populate(area[0].start, area[0].end - area[0].start);
+  Populate(area[1].start, area[1].end - area[1].start);
+  return NULL;
+}
+
+/*
+ * start user memory population in place or by the helper thread. the
+ * thread must be joined (PrefaultWait()) before the user manifest and
+ * the channels state change the protection of the heap end
+ */
+static void PrefaultUserMemory(struct NaClApp *nap)
+{
+  memset(prefault_area, 0, sizeof prefault_area);
+  if(nap->mem_map[HeapIdx].start != 0)
+    prefault_area[0] = nap->mem_map[HeapIdx];
+  prefault_area[1] = nap->mem_map[StackIdx];
+
+  if(nap->manifest->prefault == 1)
+    PrefaultMain(prefault_area);
+  else if(nap->manifest->prefault == 2)
+  {
+    prefault_started = pthread_create(&prefault_thread,
+        NULL, PrefaultMain, prefault_area) == 0;
+    ZLOGIF(!prefault_started, "cannot start prefault thread");
+  }
+}
+
+void PrefaultWait()
+{
+  if(!prefault_started) return;
+  pthread_join(prefault_thread, NULL);
+  prefault_started = 0;
+}
+
+/* ask the kernel to back the area with transparent huge pages */
+static void AdviseHugePages(uintptr_t area, int64_t size)
+{
+  int code = NaCl_madvise((void*)area, size, MADV_HUGEPAGE);
+  ZLOGIF(code != 0, "cannot advise huge pages: %s", strerror(-code));
+}
+
 void PreallocateUserMemory(struct NaClApp *nap)
 {
   uintptr_t i;
@@ -152,6 +249,79 @@ void PreallocateUserMemory(struct NaClApp *nap)
 
   nap->mem_map[HeapIdx].size += heap;
   nap->mem_map[HeapIdx].end += heap;
+
+  /*
+   * huge pages are only advised: hugetlbfs pages cannot be protected
+   * with 64kb granularity. the advice does not change mem_map
+   */
+  if(nap->manifest->huge_pages > 0)
+    AdviseHugePages((uintptr_t)p, heap);
+  if(nap->manifest->huge_pages > 1)
+    AdviseHugePages(nap->mem_map[TextIdx].start, nap->mem_map[TextIdx].size);
+
+  /* take the page faults before the session start */
+  PrefaultUserMemory(nap);
+}
+
+/* the loaded program memory kept for the session recycling */
+static struct MemBlock kept_map[MemMapSize];
+static uintptr_t kept_break = 0;
+static uintptr_t kept_heap_end = 0;
+static void *kept_data = NULL;
+static int64_t kept_data_size = 0;
+
+void KeepUserMemory(struct NaClApp *nap)
+{
+  uintptr_t data;
+
+  assert(nap != NULL);
+
+  memcpy(kept_map, nap->mem_map, sizeof kept_map);
+  kept_break = nap->break_addr;
+  kept_heap_end = nap->heap_end;
+  if(nap->data_start == 0) return;
+
+  data = NaClUserToSys(nap, nap->data_start);
+  kept_data_size = NaClUserToSys(nap, ROUNDUP_64K(nap->data_end)) - data;
+  kept_data = g_malloc(kept_data_size);
+  memcpy(kept_data, (void*)data, kept_data_size);
+}
+
+void ResetUserMemory(struct NaClApp *nap)
+{
+  uintptr_t start;
+  int64_t size;
+  int code;
+  int i;
+
+  assert(nap != NULL);
+
+  /* everything above the text and read only data (jailed code included) */
+  start = ROUNDUP_64K(MAX(kept_map[TextIdx].end, kept_map[RODataIdx].end));
+  size = nap->mem_start + FOURGIG - start;
+  code = NaCl_mprotect((void*)start, size, PROT_NONE);
+  ZLOGFAIL(0 != code, -code, "cannot protect user memory");
+  code = NaCl_madvise((void*)start, size, MADV_DONTNEED);
+  ZLOGFAIL(0 != code, -code, "cannot drop user memory");
+
+  /* the heap (with r/w data) and the stack get the loaded program state */
+  for(i = HeapIdx; i < RightBumperIdx; ++i)
+  {
+    if(kept_map[i].size == 0) continue;
+    code = NaCl_mprotect((void*)kept_map[i].start,
+        kept_map[i].size, kept_map[i].prot);
+    ZLOGFAIL(0 != code, -code, "cannot protect %s", kept_map[i].name);
+  }
+  if(kept_data != NULL)
+    memcpy((void*)NaClUserToSys(nap, nap->data_start),
+        kept_data, kept_data_size);
+
+  memcpy(nap->mem_map, kept_map, sizeof kept_map);
+  nap->break_addr = kept_break;
+  nap->heap_end = kept_heap_end;
+
+  /* the dropped memory is populated anew */
+  PrefaultUserMemory(nap);
 }
 
 /* TODO(d'b): move it to sel_addrspace */
@@ -172,11 +342,13 @@ struct UserManifestSerialized
   uint32_t stack_size;
   int32_t channels_count;
   uint32_t channels;
+  uint32_t channels_state;
 };
 
 #define USER_PTR_SIZE sizeof(int32_t)
 #define CHANNEL_STRUCT_SIZE sizeof(struct ChannelSerialized)
 #define USER_MANIFEST_STRUCT_SIZE sizeof(struct UserManifestSerialized)
+#define CHANNELS_STATE_SIZE(n) ROUNDUP_64K((n) * sizeof(struct ZVMChannelState))
 
 /* set pointer to user manifest */
 static void SetUserManifestPtr(struct NaClApp *nap, void *mft)
@@ -246,6 +418,51 @@ static void ProtectUserManifest(struct NaClApp *nap, void *mft)
       nap->mem_map[HeapIdx].end - nap->mem_map[HeapIdx].start;
 }
 
+void SetChannelsState(struct NaClApp *nap)
+{
+  struct UserManifestSerialized *user_manifest;
+  struct ZVMChannelState *state;
+  uintptr_t *mft;
+  void *user_state;
+  int64_t size;
+  int i;
+
+  assert(nap != NULL);
+  assert(nap->manifest != NULL);
+  assert(nap->manifest->channels != NULL);
+
+  /* find the channels state in the user manifest */
+  mft = (void*)NaClUserToSys(nap, FOURGIG - nap->stack_size - USER_PTR_SIZE);
+  user_manifest = (void*)NaClUserToSys(nap, *mft);
+  user_state = (void*)NaClUserToSys(nap, user_manifest->channels_state);
+  size = CHANNELS_STATE_SIZE(nap->manifest->channels->len);
+
+  /* release the alias inherited from the daemon */
+  state = CH_CH(nap->manifest, 0)->state;
+  if(state != NULL)
+    ZLOGIF(munmap(state, size) != 0, "cannot unmap channels state");
+
+  /*
+   * the state pages are shared between 2 mappings: writable one for
+   * zerovm and read only one for the user. it allows to update the
+   * state without the user memory protection change upon each trap
+   */
+  state = mmap(NULL, size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  ZLOGFAIL(state == MAP_FAILED, errno, "cannot allocate channels state");
+  user_state = mremap(state, 0, size, MREMAP_MAYMOVE | MREMAP_FIXED, user_state);
+  ZLOGFAIL(user_state == MAP_FAILED, errno, "cannot map channels state");
+  i = NaCl_mprotect(user_state, size, PROT_READ);
+  ZLOGFAIL(0 != i, -i, "cannot protect channels state");
+
+  /* bind channels to the state records and initialize them */
+  for(i = 0; i < nap->manifest->channels->len; ++i)
+  {
+    CH_CH(nap->manifest, i)->state = &state[i];
+    UpdateChannelState(CH_CH(nap->manifest, i));
+  }
+}
+
 void SetSystemData(struct NaClApp *nap)
 {
   struct Manifest *manifest;
@@ -271,7 +488,7 @@ void SetSystemData(struct NaClApp *nap)
   size += USER_MANIFEST_STRUCT_SIZE + USER_PTR_SIZE;
   ptr = (void*)(FOURGIG - nap->stack_size - size);
   user_manifest = (void*)NaClUserToSys(nap, (uintptr_t)ptr);
-  channels = (void*)((uintptr_t)&user_manifest->channels + USER_PTR_SIZE);
+  channels = (void*)(user_manifest + 1);
 
   /* make the 1st page of user manifest writable */
   CopyDown((void*)NaClUserToSys(nap, FOURGIG - nap->stack_size), "");
@@ -298,8 +515,13 @@ void SetSystemData(struct NaClApp *nap)
     channels[i].name = NaClSysToUser(nap, (uintptr_t)ptr);
   }
 
+  /* channels state occupies own pages below the aliases */
+  ptr = (void*)(ROUNDDOWN_64K((uintptr_t)ptr)
+      - CHANNELS_STATE_SIZE(manifest->channels->len));
+  user_manifest->channels_state = NaClSysToUser(nap, (uintptr_t)ptr);
+
   /* update heap_size in the user manifest */
-  size = ROUNDDOWN_64K(NaClSysToUser(nap, (uintptr_t)ptr));
+  size = NaClSysToUser(nap, (uintptr_t)ptr);
   size = MIN(nap->heap_end, size);
   user_manifest->heap_size = size - nap->break_addr;
 
@@ -317,5 +539,6 @@ void SetSystemData(struct NaClApp *nap)
 
   /* make the user manifest read only */
   ProtectUserManifest(nap, ptr);
+  SetChannelsState(nap);
 }
 /* }} */
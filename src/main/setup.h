@@ -25,8 +25,9 @@ EXTERN_C_BEGIN
 
 #define HELP_SCREEN /* update command line switches here */\
     "%s%s\033[1m\033[37mZeroVM tag%d\033[0m lightweight VM manager, build 2013-12-02\n"\
-    "Usage: <manifest> [-v#] [-T#] [-stFPQ]\n\n"\
+    "Usage: <manifest> [-v#] [-T#] [-C#] [-stFPQ]\n\n"\
     " -s skip validation\n"\
+    " -C <path> validation cache directory\n"\
     " -t <0..2> report to stdout/log/fast (default 0)\n"\
     " -v <0..3> log verbosity (default 0)\n"\
     " -F quit right before starting user session\n"\
@@ -45,12 +46,33 @@ int NaClSegmentValidates(uint8_t* mbase, size_t size, uint32_t vbase);
  */
 void LastDefenseLine();
 
-/* preallocate memory area of given size. abort if fail */
+/*
+ * preallocate memory area of given size. abort if fail. if "Prefault"
+ * specified the user memory population is started
+ */
 void PreallocateUserMemory(struct NaClApp *nap);
 
+/* wait until the user memory population (if started) is complete */
+void PrefaultWait();
+
+/* keep the user memory map and r/w data of the loaded program */
+void KeepUserMemory(struct NaClApp *nap);
+
+/*
+ * reset the user memory to the kept one: the heap, the stack and the user
+ * manifest pages are dropped, the r/w data is restored
+ */
+void ResetUserMemory(struct NaClApp *nap);
+
+/* apply the manifest memory policy to the (not yet populated) user space */
+void SetMemoryPolicy(struct NaClApp *nap);
+
 /* serialize system data to user space */
 void SetSystemData(struct NaClApp *nap);
 
+/* (re)map the channels state to user space and bind channels to it */
+void SetChannelsState(struct NaClApp *nap);
+
 /* initialize "ztrace" service. if name == NULL exit silently */
 void ZTraceCtor(const char *name);
 
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <assert.h>
+#include <dlfcn.h>
+#include <cpuid.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "src/loader/sel_ldr.h"
+#include "src/main/setup.h"
+#include "src/main/vcache.h"
+
+#define CACHE_CHECKSUM G_CHECKSUM_SHA256
+#define IMAGE_SUFFIX ".image"
+#define IMAGE_MAGIC "ZVMIMG01"
+
+/* the image header. the pages follow from NACL_PAGESIZE offset */
+struct ImageHeader {
+  char magic[sizeof IMAGE_MAGIC];
+  uint64_t static_text_end;
+  uint64_t dynamic_text_start;
+  uint64_t dynamic_text_end;
+  uint64_t rodata_start;
+  uint64_t data_start;
+  uint64_t data_end;
+  uint64_t break_addr;
+  uint64_t initial_entry_pt;
+  uint64_t size;
+};
+
+static char *cache_path = NULL;
+
+void ValidationCacheCtor(const char *path)
+{
+  struct stat st;
+
+  ValidationCacheDtor();
+  if(path == NULL) return;
+
+  /* the cache is trusted: hit skips the validation */
+  ZLOGFAIL(stat(path, &st) != 0 || !S_ISDIR(st.st_mode), ENOENT,
+      "invalid validation cache %s", path);
+  ZLOGFAIL(st.st_uid != getuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0,
+      EPERM, "validation cache %s is not private", path);
+
+  cache_path = g_strdup(path);
+}
+
+void ValidationCacheDtor()
+{
+  g_free(cache_path);
+  cache_path = NULL;
+}
+
+/* add the validator library identity and the cpu features to the key */
+static void ValidatorIdentity(GChecksum *ctx)
+{
+  Dl_info info;
+  struct stat st;
+  const char *name = "/proc/self/exe"; /* statically linked validator */
+  uint32_t regs[5] = {0};
+  uint32_t dummy;
+
+  /* validator is updated with the library (or zerovm) file */
+  if(dladdr((void*)NaClSegmentValidates, &info) != 0 && info.dli_fname != NULL)
+    name = info.dli_fname;
+  ZLOGFAIL(stat(name, &st) != 0, errno, "cannot get validator identity");
+  g_checksum_update(ctx, (const guchar*)name, strlen(name));
+  g_checksum_update(ctx, (const guchar*)&st.st_ino, sizeof st.st_ino);
+  g_checksum_update(ctx, (const guchar*)&st.st_size, sizeof st.st_size);
+  g_checksum_update(ctx, (const guchar*)&st.st_mtime, sizeof st.st_mtime);
+
+  /* validator rejects instructions unsupported by the cpu */
+  __get_cpuid(1, &dummy, &dummy, &regs[0], &regs[1]);
+  __get_cpuid_count(7, 0, &dummy, &regs[2], &regs[3], &regs[4]);
+  g_checksum_update(ctx, (const guchar*)regs, sizeof regs);
+}
+
+char *ValidationCacheKey(const uint8_t *static_addr, int64_t static_size,
+    const uint8_t *dynamic_addr, int64_t dynamic_size, uint32_t entry)
+{
+  GChecksum *ctx;
+  char *key;
+
+  if(cache_path == NULL) return NULL;
+
+  ctx = g_checksum_new(CACHE_CHECKSUM);
+  ZLOGFAIL(ctx == NULL, EFAULT, "error initializing validation cache key");
+
+  ValidatorIdentity(ctx);
+  g_checksum_update(ctx, (const guchar*)&entry, sizeof entry);
+  g_checksum_update(ctx, (const guchar*)&static_size, sizeof static_size);
+  g_checksum_update(ctx, (const guchar*)&dynamic_size, sizeof dynamic_size);
+  if(static_size > 0) g_checksum_update(ctx, static_addr, static_size);
+  if(dynamic_size > 0) g_checksum_update(ctx, dynamic_addr, dynamic_size);
+
+  key = g_strdup(g_checksum_get_string(ctx));
+  g_checksum_free(ctx);
+  return key;
+}
+
+int ValidationCacheHit(const char *key)
+{
+  char *name;
+  char *content = NULL;
+  int result;
+
+  if(key == NULL) return 0;
+
+  /* the record contains own key to detect broken records */
+  name = g_build_filename(cache_path, key, NULL);
+  result = g_file_get_contents(name, &content, NULL, NULL)
+      && g_strcmp0(content, key) == 0;
+  ZLOGS(LOG_DEBUG, "validation cache %s: %s", result ? "hit" : "miss", key);
+
+  g_free(content);
+  g_free(name);
+  return result;
+}
+
+void ValidationCacheStore(const char *key)
+{
+  char *name;
+
+  if(key == NULL) return;
+
+  /* glib writes the temporary file and renames it (atomic update) */
+  name = g_build_filename(cache_path, key, NULL);
+  ZLOGIF(!g_file_set_contents(name, key, -1, NULL),
+      "cannot update validation cache %s", name);
+  g_free(name);
+}
+
+/*
+ * return the prepared image file name of the program or NULL. the key is
+ * the program file identity: any change of the file changes its ctime
+ * WARNING: returned string should be deallocated with g_free
+ */
+static char *ImageName(struct NaClApp *nap)
+{
+  GChecksum *ctx;
+  struct stat st;
+  char *file;
+  char *name;
+  const char *program = nap->manifest->program;
+
+  if(cache_path == NULL || stat(program, &st) != 0) return NULL;
+
+  ctx = g_checksum_new(CACHE_CHECKSUM);
+  ZLOGFAIL(ctx == NULL, EFAULT, "error initializing image cache key");
+
+  /* the image depends on the program, the validator and the loader */
+  ValidatorIdentity(ctx);
+  g_checksum_update(ctx, (const guchar*)program, strlen(program));
+  g_checksum_update(ctx, (const guchar*)&st.st_dev, sizeof st.st_dev);
+  g_checksum_update(ctx, (const guchar*)&st.st_ino, sizeof st.st_ino);
+  g_checksum_update(ctx, (const guchar*)&st.st_size, sizeof st.st_size);
+  g_checksum_update(ctx, (const guchar*)&st.st_mtim, sizeof st.st_mtim);
+  g_checksum_update(ctx, (const guchar*)&st.st_ctim, sizeof st.st_ctim);
+  ZLOGFAIL(stat("/proc/self/exe", &st) != 0, errno, "cannot get zerovm identity");
+  g_checksum_update(ctx, (const guchar*)&st.st_ino, sizeof st.st_ino);
+  g_checksum_update(ctx, (const guchar*)&st.st_mtim, sizeof st.st_mtim);
+
+  file = g_strconcat(g_checksum_get_string(ctx), IMAGE_SUFFIX, NULL);
+  name = g_build_filename(cache_path, file, NULL);
+  g_checksum_free(ctx);
+  g_free(file);
+  return name;
+}
+
+/*
+ * the same limits as the session image has (see snapshot.c). the image
+ * violating them is not used
+ */
+static int ImageHeaderValid(struct NaClApp *nap, struct ImageHeader *header)
+{
+#define LIMIT(a, b) if((a) > (b)) \
+  { ZLOGS(LOG_DEBUG, "invalid prepared image: %s", #a); return 0; }
+  LIMIT(header->data_end, FOURGIG - ROUNDUP_64K(nap->stack_size));
+  LIMIT(header->static_text_end, header->data_end);
+  LIMIT(header->initial_entry_pt, header->static_text_end);
+  LIMIT(NACL_TRAMPOLINE_END, header->static_text_end);
+  LIMIT(header->static_text_end % NACL_MAP_PAGESIZE, 0);
+  LIMIT(header->rodata_start, header->data_end);
+  LIMIT(header->data_start, header->data_end);
+  LIMIT(header->break_addr, header->data_end);
+  LIMIT(header->dynamic_text_start, header->static_text_end);
+  LIMIT(header->dynamic_text_end, header->dynamic_text_start);
+  LIMIT(header->size, ROUNDUP_64K(header->data_end) - NACL_TRAMPOLINE_END);
+  LIMIT(ROUNDUP_64K(header->data_end) - NACL_TRAMPOLINE_END, header->size);
+#undef LIMIT
+  return 1;
+}
+
+int ImageCacheLoad(struct NaClApp *nap)
+{
+  struct ImageHeader header;
+  struct stat st;
+  char *name;
+  int fd;
+
+  name = ImageName(nap);
+  if(name == NULL) return 0;
+  fd = open(name, O_RDONLY);
+
+  /* the image is only trusted when it is private and complete */
+  if(fd < 0 || fstat(fd, &st) != 0 || st.st_uid != getuid()
+      || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0
+      || pread(fd, &header, sizeof header, 0) != sizeof header
+      || memcmp(header.magic, IMAGE_MAGIC, sizeof header.magic) != 0
+      || !ImageHeaderValid(nap, &header)
+      || st.st_size != NACL_PAGESIZE + header.size)
+  {
+    ZLOGS(LOG_DEBUG, "image cache miss: %s", name);
+    if(fd >= 0) close(fd);
+    g_free(name);
+    return 0;
+  }
+
+  nap->static_text_end = header.static_text_end;
+  nap->dynamic_text_start = header.dynamic_text_start;
+  nap->dynamic_text_end = header.dynamic_text_end;
+  nap->rodata_start = header.rodata_start;
+  nap->data_start = header.data_start;
+  nap->data_end = header.data_end;
+  nap->break_addr = header.break_addr;
+  nap->initial_entry_pt = header.initial_entry_pt;
+  AppLoadImage(nap, fd, NACL_PAGESIZE);
+
+  ZLOGS(LOG_DEBUG, "image cache hit: %s", name);
+  close(fd);
+  g_free(name);
+  return 1;
+}
+
+void ImageCacheStore(struct NaClApp *nap)
+{
+  struct ImageHeader header = {IMAGE_MAGIC};
+  char page[NACL_PAGESIZE] = {0};
+  char *name;
+  char *tmp;
+  int fd;
+  int ok;
+
+  name = ImageName(nap);
+  if(name == NULL) return;
+
+  header.static_text_end = nap->static_text_end;
+  header.dynamic_text_start = nap->dynamic_text_start;
+  header.dynamic_text_end = nap->dynamic_text_end;
+  header.rodata_start = nap->rodata_start;
+  header.data_start = nap->data_start;
+  header.data_end = nap->data_end;
+  header.break_addr = nap->break_addr;
+  header.initial_entry_pt = nap->initial_entry_pt;
+  header.size = ROUNDUP_64K(nap->data_end) - NACL_TRAMPOLINE_END;
+  memcpy(page, &header, sizeof header);
+
+  /* write the temporary file and rename it (atomic update) */
+  tmp = g_strconcat(name, ".XXXXXX", NULL);
+  fd = g_mkstemp_full(tmp, O_WRONLY, S_IRUSR);
+  ok = fd >= 0
+      && write(fd, page, sizeof page) == sizeof page
+      && write(fd, (void*)(nap->mem_start + NACL_TRAMPOLINE_END), header.size)
+        == (ssize_t)header.size;
+  if(fd >= 0) ok &= close(fd) == 0;
+  ok = ok && rename(tmp, name) == 0;
+  if(!ok) unlink(tmp);
+  ZLOGIF(!ok, "cannot update image cache %s", name);
+
+  g_free(tmp);
+  g_free(name);
+}
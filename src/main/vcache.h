@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VCACHE_H_
+#define VCACHE_H_
+
+#include <stdint.h>
+
+struct NaClApp;
+
+/*
+ * enable persistent validation cache in "path" directory. the directory
+ * must be private (only writable by zerovm user). NULL disables the cache
+ */
+void ValidationCacheCtor(const char *path);
+
+/* release the cache resources */
+void ValidationCacheDtor();
+
+/*
+ * return the key of the text (static and dynamic segments) validated with
+ * "entry" as the base address or NULL if the cache is disabled
+ * WARNING: returned string should be deallocated with g_free
+ */
+char *ValidationCacheKey(const uint8_t *static_addr, int64_t static_size,
+    const uint8_t *dynamic_addr, int64_t dynamic_size, uint32_t entry);
+
+/* return 1 if the text with "key" was successfully validated before */
+int ValidationCacheHit(const char *key);
+
+/* remember the successful validation of the text with "key" */
+void ValidationCacheStore(const char *key);
+
+/*
+ * load the prepared (loaded, patched and validated) image of the program.
+ * return 1 if the image was found and loaded, otherwise 0
+ */
+int ImageCacheLoad(struct NaClApp *nap);
+
+/* save the image of the loaded and validated program */
+void ImageCacheStore(struct NaClApp *nap);
+
+#endif /* VCACHE_H_ */
@@ -23,13 +23,18 @@
  */
 
 #include <assert.h>
+#include <sched.h>
+#include <pthread.h>
 #include "src/platform/signal.h"
 #include "src/main/setup.h"
 #include "src/main/report.h"
 #include "src/platform/qualify.h"
 #include "src/main/accounting.h"
 #include "src/main/tools.h"
+#include "src/main/vcache.h"
 #include "src/channels/preload.h"
+#include "src/syscalls/snapshot.h"
+#include "src/syscalls/daemon.h"
 
 #define BADCMDLINE(msg) \
   do { \
@@ -65,7 +70,7 @@ static void ParseCommandLine(struct NaClApp *nap, int argc, char **argv)
   ZLogCtor(LOG_ERROR);
   CommandLine(argc, argv);
 
-  while((opt = getopt(argc, argv, "-PFQst:v:M:T:")) != -1)
+  while((opt = getopt(argc, argv, "-PFQst:v:C:M:T:")) != -1)
   {
     switch(opt)
     {
@@ -100,6 +105,9 @@ static void ParseCommandLine(struct NaClApp *nap, int argc, char **argv)
       case 'T':
         ZTraceCtor(optarg);
         break;
+      case 'C':
+        ValidationCacheCtor(optarg);
+        break;
       default:
         BADCMDLINE(NULL);
         break;
@@ -116,9 +124,111 @@ static void ParseCommandLine(struct NaClApp *nap, int argc, char **argv)
   ZLOGFAIL(psize < 0, ENOENT, "program open error");
 }
 
+/* smallest text part validated by the single thread */
+#define VALIDATION_CHUNK 0x100000
+
+/* text to validate in parallel. chunks are taken by the workers */
+struct ValidationJob {
+  uint8_t *addr;
+  int64_t size;
+  uint32_t vbase;
+  int chunks;
+  int next; /* the next chunk to take */
+  int8_t *failed; /* per chunk, written only by the chunk worker */
+};
+
+/* validate chunks [first, last) as one segment. return 1 if valid */
+static int ChunksValidate(struct ValidationJob *job, int first, int last)
+{
+  int64_t offset = (int64_t)first * VALIDATION_CHUNK;
+  int64_t size = MIN((int64_t)last * VALIDATION_CHUNK, job->size) - offset;
+
+  return NaClSegmentValidates(job->addr + offset, size, job->vbase + offset);
+}
+
+/* validation worker: validate chunks until none left */
+static void *ValidationWorker(void *arg)
+{
+  struct ValidationJob *job = arg;
+  int i;
+
+  while((i = __sync_fetch_and_add(&job->next, 1)) < job->chunks)
+    job->failed[i] = !ChunksValidate(job, i, i + 1);
+  return NULL;
+}
+
+/*
+ * validate the text by bundle aligned chunks in parallel. no instruction
+ * crosses a bundle, so chunks decode the same way as the whole text. the
+ * passed chunk is valid: its branches land on its own instructions or on
+ * bundles. the chunk can fail because of a branch into the middle of a
+ * bundle of another chunk (e.g. a function crossing the chunk border), so
+ * only failed chunks are validated again together with the neighbours,
+ * the window grows until it passes or covers the whole text
+ * return 1 if the text is valid, otherwise 0
+ */
+static int ParallelValidates(uint8_t *addr, int64_t size, uint32_t vbase)
+{
+  struct ValidationJob job = {addr, size, vbase, 0, 0, NULL};
+  pthread_t workers[CPU_SETSIZE];
+  cpu_set_t cpus;
+  int rechecks = 0;
+  int result = 1;
+  int count;
+  int i;
+
+  assert(VALIDATION_CHUNK % NACL_INSTR_BLOCK_SIZE == 0);
+
+  /* use all available cpus, but not more than chunks */
+  job.chunks = (size + VALIDATION_CHUNK - 1) / VALIDATION_CHUNK;
+  count = sched_getaffinity(0, sizeof cpus, &cpus) == 0 ? CPU_COUNT(&cpus) : 1;
+  count = MIN(count, job.chunks);
+  if(count < 2) return NaClSegmentValidates(addr, size, vbase);
+  job.failed = g_malloc0(job.chunks);
+
+  /* the calling thread is one of the workers */
+  for(i = 1; i < count; ++i)
+    if(pthread_create(&workers[i], NULL, ValidationWorker, &job) != 0) break;
+  count = i;
+  ValidationWorker(&job);
+  for(i = 1; i < count; ++i)
+    pthread_join(workers[i], NULL);
+
+  /* reconcile the failed chunks */
+  for(i = 0; i < job.chunks && result != 0; ++i)
+  {
+    int radius;
+    int first = i;
+    int last = i + 1;
+
+    if(!job.failed[i]) continue;
+    for(radius = 1; ; radius *= 2)
+    {
+      first = MAX(0, i - radius);
+      last = MIN(job.chunks, i + radius + 1);
+      ++rechecks;
+      if(ChunksValidate(&job, first, last)) break;
+      if(first == 0 && last == job.chunks)
+      {
+        result = 0;
+        break;
+      }
+    }
+
+    /* the passed window proves all its chunks */
+    memset(job.failed + first, 0, last - first);
+  }
+
+  ZLOGS(LOG_DEBUG, "%d chunks validated by %d threads, %d rechecks, %s",
+      job.chunks, count, rechecks, result ? "passed" : "failed");
+  g_free(job.failed);
+  return result;
+}
+
 static void ValidateProgram(struct NaClApp *nap)
 {
   int status = 0; /* 0 = failed, 1 = successful */
+  char *key;
   int64_t static_size;
   int64_t dynamic_size;
   uint8_t* static_addr;
@@ -134,11 +244,20 @@ static void ValidateProgram(struct NaClApp *nap)
   static_addr = (uint8_t*)NaClUserToSys(nap, NACL_TRAMPOLINE_END);
   dynamic_addr = (uint8_t*)NaClUserToSys(nap, nap->dynamic_text_start);
 
-  /* validate static and dynamic text */
-  if(static_size > 0)
-    status = NaClSegmentValidates(static_addr, static_size, nap->initial_entry_pt);
-  if(dynamic_size > 0)
-    status &= NaClSegmentValidates(dynamic_addr, dynamic_size, nap->initial_entry_pt);
+  /* validate static and dynamic text unless it was validated before */
+  key = ValidationCacheKey(static_addr, static_size,
+      dynamic_addr, dynamic_size, nap->initial_entry_pt);
+  if(ValidationCacheHit(key))
+    status = 1;
+  else
+  {
+    if(static_size > 0)
+      status = ParallelValidates(static_addr, static_size, nap->initial_entry_pt);
+    if(dynamic_size > 0)
+      status &= NaClSegmentValidates(dynamic_addr, dynamic_size, nap->initial_entry_pt);
+    if(status != 0) ValidationCacheStore(key);
+  }
+  g_free(key);
 
   /* set results */
   SetValidationState(1);
@@ -146,24 +265,15 @@ static void ValidateProgram(struct NaClApp *nap)
   SetValidationState(0);
 }
 
-int main(int argc, char **argv)
+/* load and validate the program, save its prepared image */
+static void LoadProgram(struct NaClApp *nap)
 {
-  struct NaClApp state = {0}, *nap = &state;
-  struct GioMemoryFileSnapshot main_file;
-
-  /* initialize globals and set nap fields to default values */
-  ReportCtor();
-  NaClAppCtor(nap);
-  ParseCommandLine(nap, argc, argv);
-
-  /* We use the signal handler to verify a signal took place. */
-  if(skip_qualification == 0) RunSelQualificationTests();
-  SignalHandlerInit();
+  struct GioMmapFile main_file;
 
   /* read elf into memory */
-  ZLOGFAIL(0 == GioMemoryFileSnapshotCtor(&main_file, nap->manifest->program),
+  ZLOGFAIL(0 == GioMmapFileCtor(&main_file, nap->manifest->program),
       ENOENT, "Cannot open '%s'. %s", nap->manifest->program, strerror(errno));
-  ZTrace("[memory snapshot]");
+  ZTrace("[program mapping]");
 
   /* validate program structure (check elf header and segments) */
   ZLOGS(LOG_DEBUG, "Loading %s", nap->manifest->program);
@@ -179,22 +289,86 @@ int main(int argc, char **argv)
   if(-1 == (*((struct Gio *)&main_file)->vtbl->Close)((struct Gio *)&main_file))
     ZLOG(LOG_ERROR, "Error while closing '%s'", nap->manifest->program);
   (*((struct Gio *) &main_file)->vtbl->Dtor)((struct Gio *) &main_file);
-  ZTrace("[snapshot deallocation]");
+  ZTrace("[program unmapping]");
 
-  /* initialize all channels */
-  ChannelsCtor(nap->manifest);
-  ZLOGS(LOG_DEBUG, "channels constructed");
-  ZTrace("[channels mounting]");
+  /* the image of not validated program cannot be reused */
+  if(!skip_validation) ImageCacheStore(nap);
+}
+
+int main(int argc, char **argv)
+{
+  struct NaClApp state = {0}, *nap = &state;
+  int restored;
+
+  /* initialize globals and set nap fields to default values */
+  ReportCtor();
+  NaClAppCtor(nap);
+  ParseCommandLine(nap, argc, argv);
+
+  /* We use the signal handler to verify a signal took place. */
+  if(skip_qualification == 0) RunSelQualificationTests();
+  SignalHandlerInit();
+
+  /*
+   * the session image or the prepared image (if cached) replaces the
+   * program loading
+   */
+  restored = LoadSession(nap, nap->manifest->program) == 0;
+  if(restored)
+    ZTrace("[session image loading]");
+  else if(ImageCacheLoad(nap))
+  {
+    ZTrace("[prepared image loading]");
+    if(!skip_validation) ValidateProgram(nap);
+    ZTrace("[prepared image validation]");
+  }
+  else
+    LoadProgram(nap);
 
   /*
    * allocate user heap. should be the last allocation in raw because
-   * after heap allocated there will be no free user memory
+   * after heap allocated there will be no free user memory. the memory
+   * population (if asked) goes in parallel with the channels mounting
    */
   PreallocateUserMemory(nap);
   ZLOGS(LOG_DEBUG, "user memory preallocated");
   ZTrace("[user memory preallocation]");
 
-  /* set user manifest in user space */
+  /*
+   * initialize all channels. the warm daemon forks the sessions before
+   * that, the spawned session gets the channels of the request. the
+   * recycled session gets them the same way, but without fork
+   */
+  if(nap->manifest->warm)
+  {
+    ZLOGFAIL(restored, EFAULT, "session image cannot be warm");
+    PrefaultWait();
+    if(WarmDaemon(nap) == 0)
+    {
+      SetExitState(OK_STATE);
+      ReportDtor(0);
+    }
+  }
+  else if(nap->manifest->recycle)
+  {
+    ZLOGFAIL(restored, EFAULT, "session image cannot be recycled");
+    RecycleCtor(nap);
+  }
+  else
+    ChannelsCtor(nap->manifest);
+  ZLOGS(LOG_DEBUG, "channels constructed");
+  ZTrace("[channels mounting]");
+
+  /* restore the saved session memory and validate it */
+  if(restored)
+  {
+    RestoreSession(nap);
+    if(!skip_validation) ValidateProgram(nap);
+    ZTrace("[session restoring]");
+  }
+
+  /* set user manifest in user space. the heap end must not be populated */
+  PrefaultWait();
   SetSystemData(nap);
   ZLOGS(LOG_DEBUG, "system data set");
   ZTrace("[user manifest construction]");
@@ -213,6 +387,7 @@ int main(int argc, char **argv)
 
   /* switch to the user code flushing all buffers */
   fflush(NULL);
+  if(restored) ResumeSession(nap);
   CreateSession(nap);
   return EFAULT; /* unreachable */
 }
@@ -141,6 +141,27 @@ int GioMemoryFileSnapshotCtor(struct GioMemoryFileSnapshot *self, char *fn);
 
 void GioMemoryFileSnapshotDtor(struct Gio *vself);
 
+/* read only memory mapped file */
+struct GioMmapFile {
+  struct GioMemoryFile base;
+  int fd;
+  int mappable; /* the file pages can be mapped to the user space */
+};
+
+int GioMmapFileCtor(struct GioMmapFile *self, char *fn);
+
+ssize_t GioMmapFileWrite(struct Gio *vself, const void *buf, size_t count);
+
+void GioMmapFileDtor(struct Gio *vself);
+
+/*
+ * map "size" bytes of the file from "offset" to "addr" (copy-on-write,
+ * read / write). return 0 on success, -1 if "vself" is not a mappable
+ * file, the area is not page aligned or the mapping failed. the mapped
+ * pages follow the file changes: not for the code to validate
+ */
+int GioMmapFileMap(struct Gio *vself, void *addr, size_t size, off_t offset);
+
 EXTERN_C_END
 
 #endif  /* GIO_H_ */
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * NaCl Generic I/O interface implementation: read only memory mapped file.
+ * besides the reading the file pages can be mapped to the given address
+ */
+#include <sys/mman.h>
+#include "src/main/config.h"
+#include "src/platform/gio.h"
+
+struct GioVtbl const kGioMmapFileVtbl = {
+  GioMemoryFileRead,
+  GioMmapFileWrite,
+  GioMemoryFileSeek,
+  GioMemoryFileFlush,
+  GioMemoryFileClose,
+  GioMmapFileDtor,
+};
+
+int GioMmapFileCtor(struct GioMmapFile *self, char *fn)
+{
+  struct stat fs;
+  void *buffer;
+
+  ((struct Gio *) self)->vtbl = NULL;
+  self->fd = open(fn, O_RDONLY);
+  if(self->fd < 0) return 0;
+  if(fstat(self->fd, &fs) != 0 || fs.st_size == 0)
+  {
+    close(self->fd);
+    return 0;
+  }
+
+  buffer = mmap(NULL, fs.st_size, PROT_READ, MAP_PRIVATE, self->fd, 0);
+  if(buffer == MAP_FAILED)
+  {
+    close(self->fd);
+    return 0;
+  }
+
+  /*
+   * not copied pages of private mapping follow the file changes. allow
+   * to map the file to the user space only if nobody else can change it
+   */
+  self->mappable = (fs.st_mode & (S_IWGRP | S_IWOTH)) == 0
+      && (fs.st_uid == getuid() || fs.st_uid == 0);
+
+  GioMemoryFileCtor(&self->base, buffer, fs.st_size);
+  ((struct Gio *) self)->vtbl = &kGioMmapFileVtbl;
+  return 1;
+}
+
+ssize_t GioMmapFileWrite(struct Gio *vself, const void *buf, size_t count)
+{
+  UNREFERENCED_PARAMETER(vself);
+  UNREFERENCED_PARAMETER(buf);
+  UNREFERENCED_PARAMETER(count);
+  errno = EBADF;
+  return -1;
+}
+
+int GioMmapFileMap(struct Gio *vself, void *addr, size_t size, off_t offset)
+{
+  struct GioMmapFile *self = (struct GioMmapFile *) vself;
+  void *p;
+
+  /* only the mapped files with page aligned areas can be used */
+  if(vself->vtbl != &kGioMmapFileVtbl || !self->mappable) return -1;
+  if(((uintptr_t)addr | offset) & (NACL_PAGESIZE - 1)) return -1;
+  if(offset + size > self->base.len) return -1;
+
+  p = mmap(addr, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_FIXED, self->fd, offset);
+  return p == addr ? 0 : -1;
+}
+
+void GioMmapFileDtor(struct Gio *vself)
+{
+  struct GioMmapFile *self = (struct GioMmapFile *) vself;
+
+  /* the user space mappings stay valid */
+  munmap(self->base.buffer, self->base.len);
+  close(self->fd);
+  GioMemoryFileDtor(vself);
+}
@@ -58,7 +58,7 @@ static int s_Signals[] = {
   /* reserved for the future */
   SIGALRM,
   SIGTERM,
-  /* reserved for the snapshot engine */
+  /* the session saving (see snapshot.c) */
   SIGPWR
 };
 
@@ -170,7 +170,8 @@ static void FindAndRunHandler(int sig, siginfo_t *info, void *uc)
 
 static void SignalCatch(int sig, siginfo_t *info, void *uc)
 {
-  busy = 1;
+  /* the session save request returns, the signal stack is not left busy */
+  if(sig != SIGPWR) busy = 1;
   FindAndRunHandler(sig, info, uc);
 }
 
@@ -192,6 +193,21 @@ static void SignalAssertNoHandlers()
   }
 }
 
+void *SignalThreadCtor()
+{
+  void *stack;
+
+  SignalStackAllocate(&stack);
+  SignalStackRegister(stack);
+  return stack;
+}
+
+void SignalThreadDtor(void *stack)
+{
+  SignalStackUnregister();
+  SignalStackFree(stack);
+}
+
 void SignalHandlerInitPlatform()
 {
   struct sigaction sa;
@@ -203,7 +219,7 @@ void SignalHandlerInitPlatform()
   memset(&sa, 0, sizeof(sa));
   sigemptyset(&sa.sa_mask);
   sa.sa_sigaction = SignalCatch;
-  sa.sa_flags = SA_ONSTACK | SA_SIGINFO;
+  sa.sa_flags = SA_ONSTACK | SA_SIGINFO | SA_RESTART;
 
   /* Mask all exceptions we catch to prevent re-entry */
   for(i = 0; i < SIGNAL_COUNT; i++)
@@ -57,6 +57,15 @@ void SignalHandlerInit(void);
 /* Undoes the effect of SignalHandlerInit() */
 void SignalHandlerFini(void);
 
+/*
+ * allocate and register signal stack for the calling (user) thread.
+ * return the stack to be passed to SignalThreadDtor()
+ */
+void *SignalThreadCtor(void);
+
+/* unregister and free the signal stack of the calling thread */
+void SignalThreadDtor(void *stack);
+
 /*
  * Traverse handler list, until a handler returns
  * NACL_SIGNAL_RETURN, or the list is exhausted, in which case
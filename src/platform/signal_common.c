@@ -22,6 +22,7 @@
 #include "src/platform/signal.h"
 #include "src/main/report.h"
 #include "src/loader/sel_ldr.h"
+#include "src/syscalls/snapshot.h"
 
 #define MAX_HANDLERS 16
 
@@ -76,8 +77,10 @@ static struct SignalNode s_SignalNodes[MAX_HANDLERS];
  */
 static int SignalContextIsUntrusted(const struct SignalContext *sigCtx)
 {
-  if(sigCtx->prog_ctr >= START_OF_USER_SPACE
-      && sigCtx->prog_ctr < END_OF_USER_SPACE) return 1;
+  /* the user space with the bumpers (the slot is chosen at start) */
+  if(gnap == NULL || gnap->mem_start == 0) return 0;
+  if(sigCtx->prog_ctr >= gnap->mem_start - GUARDSIZE
+      && sigCtx->prog_ctr < gnap->mem_start + FOURGIG + GUARDSIZE) return 1;
   return 0;
 }
 
@@ -131,6 +134,14 @@ static enum SignalResult SignalHandleAll(int signum, void *ctx)
 
   /* TODO(d'b): is it a proper solution? */
   static int busy = 0;
+
+  /* the session is saved upon the next trap */
+  if(signum == SIGPWR)
+  {
+    SaveSessionRequest();
+    return NACL_SIGNAL_RETURN;
+  }
+
   if(busy) return NACL_SIGNAL_RETURN;
   busy = 1;
 
@@ -14,8 +14,11 @@
  * limitations under the License.
  */
 #include <assert.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/resource.h>
+#include <sys/signalfd.h>
 #include <sys/wait.h>
 #include <sys/prctl.h>
 #include "src/main/report.h"
@@ -23,65 +26,156 @@
 #include "src/main/accounting.h"
 #include "src/platform/signal.h"
 #include "src/channels/channel.h"
+#include "src/channels/prefetch.h"
 #include "src/syscalls/daemon.h"
+#include "src/syscalls/snapshot.h"
+#include "src/syscalls/spawn.h"
+#include "src/syscalls/thread.h"
 
 #define DAEMON_NAME "zvm."
 #define TASK_SIZE 0x10000 /* limited by protocol (server <-> zerovm ) */
 #define QUEUE_SIZE 16
+#define QUEUE_LIMIT 0x100 /* requests accepted but not started yet */
+#define RETRY_TIMEOUT 1000 /* msec before the failed fork retry */
 #define CMD_SIZE (sizeof(uint64_t))
+#define COMMAND_MAGIC "ZVMCMD01" /* binary command, CMD_SIZE bytes */
+#define RECORD_LIMIT 0x10000 /* the binary command record size limit */
+
+/* binary command record types (see daemon.txt) */
+enum CommandType {
+  CmdEnd,
+  CmdNode,
+  CmdTimeout,
+  CmdJob,
+  CmdSave,
+  CmdSource
+};
+
+/* binary command record header, "size" bytes of data follow */
+struct CommandRecord {
+  uint32_t type;
+  uint32_t size;
+};
+
+/* accepted request waiting for the session slot */
+struct Request {
+  int client;
+  int64_t time; /* accept() time (monotonic, usec) */
+};
+
+/* spare child waiting for the request */
+struct Spare {
+  pid_t pid;
+  int job; /* the daemon end of the child requests socket */
+  int sent; /* the request is sent but not taken yet */
+};
 
 static int client = -1;
 
+/* daemon handles: command socket, SIGCHLD, spare children pipe */
+static int sock = -1;
+static int events = -1;
+static int notify[2] = {-1, -1}; /* spare took the request (pid) */
+static int job = -1; /* spare child: requests from the daemon (datagrams) */
+
+/* daemon: accepted requests and spare children (inherited by children) */
+static struct Request queue[QUEUE_LIMIT];
+static int head = 0;
+static int queued = 0;
+static struct Spare *spares = NULL;
+static int idle = 0;
+static GPtrArray *shared = NULL; /* (File*) kept open for children */
+static int warm = 0; /* the daemon is started before the program */
+static int recycling = 0; /* the sessions are served by the same process */
+
+/* the channels sources lists kept over the channels destruction */
+static GPtrArray *kept_channels = NULL; /* (ChannelDesc*) */
+static GPtrArray **kept_sources = NULL;
+
+/* child: read "size" bytes of the command. 0: success, -1: failed */
+static int ReadCommand(void *buffer, int64_t size)
+{
+  assert(client >= 0);
+
+  while(size > 0)
+  {
+    ssize_t code = read(client, buffer, size);
+    if(code < 0 && errno == EINTR) continue;
+    if(code <= 0) return -1;
+    buffer = (char*)buffer + code;
+    size -= code;
+  }
+  return 0;
+}
+
 /*
- * child: get command from inherited command socket. current version can
- * only have one command and therefore the command format will only contain
- * one (pascal) string: 4-bytes length and data of "length" size. the data
- * is manifest (reduced form of it). WARNING: result should be freed
+ * child: get the text command. the command format is one (pascal) string:
+ * 8-bytes length (already read to "prefix") and data of "length" size. the
+ * data is manifest (reduced form of it). WARNING: result should be freed
  */
-static char *GetCommand()
+static char *GetCommand(const char *prefix)
 {
-  int len;
+  int64_t len;
   char *cmd = g_malloc0(TASK_SIZE);
 
-  assert(client >= 0);
-
-  ZLOGFAIL(read(client, cmd, CMD_SIZE) < 0, EIO, "%s", strerror(errno));
+  memcpy(cmd, prefix, CMD_SIZE);
   len = ToInt(cmd);
-  ZLOGFAIL(read(client, cmd, len) < 0, EIO, "%s", strerror(errno));
+  ZLOGFAIL(len < 0 || len >= TASK_SIZE, EFAULT, "invalid command size");
+  ZLOGFAIL(ReadCommand(cmd, len) != 0, EIO, "%s", strerror(errno));
+  cmd[len] = '\0';
 
   return cmd;
 }
 
-/* child: update "nap" with the new manifest */
-static void UpdateSession(struct Manifest *manifest)
+/* child: re-initialize signals handling, accounting, log and ztrace */
+static void ResetSession()
 {
+  sigset_t set;
   int i;
-  char *cmd = GetCommand();
-  struct Manifest *tmp = ManifestTextCtor(cmd);
 
-  /* re-initialize signals handling, accounting and the report handle */
-  g_free(cmd);
+  /* release the daemon handles and the requests of other children */
+  close(sock);
+  close(events);
+  close(notify[0]);
+  for(i = 0; i < queued; ++i)
+    if(queue[(head + i) % QUEUE_LIMIT].client != client)
+      close(queue[(head + i) % QUEUE_LIMIT].client);
+  for(i = 0; i < idle; ++i)
+    close(spares[i].job);
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  sigprocmask(SIG_UNBLOCK, &set, NULL);
+
   SignalHandlerFini();
   SignalHandlerInit();
   ResetAccounting();
-  ReportMode(3);
-  SetReportHandle(client);
   ZLogDtor();
   ZLogCtor(0);
   ZTraceCtor(NULL);
+}
+
+/* child: update "manifest" with the text command (the manifest) */
+static void TextCommand(struct Manifest *manifest, const char *prefix)
+{
+  int i;
+  char *cmd = GetCommand(prefix);
+  struct Manifest *tmp = ManifestTextCtor(cmd);
 
   /* copy needful fields from the new manifest */
+  g_free(cmd);
   manifest->timeout = tmp->timeout;
   manifest->name_server = tmp->name_server;
   manifest->node = tmp->node;
   manifest->job = tmp->job;
-
-  /* reset timeout, i/o limit, privileges e.t.c. */
-  LastDefenseLine(manifest);
+  manifest->save = tmp->save;
+  manifest->checkpoint = tmp->checkpoint;
+  manifest->cpus = tmp->cpus;
 
   /* check and partially copy channels */
   SortChannels(manifest->channels);
   SortChannels(tmp->channels);
+  ZLOGFAIL(manifest->channels->len != tmp->channels->len, EFAULT,
+      "difference in channels number");
 
   for(i = 0; i < manifest->channels->len; ++i)
   {
@@ -99,28 +193,325 @@ static void UpdateSession(struct Manifest *manifest)
     CH_CH(manifest, i)->source = CH_CH(tmp, i)->source;
     CH_CH(manifest, i)->tag = CH_CH(tmp, i)->tag;
   }
+}
+
+/* child: get 32-bit integer from the binary command record */
+static int32_t RecordInt(const char *data, uint32_t size)
+{
+  int32_t result;
+
+  ZLOGFAIL(size != sizeof result, EFAULT, "invalid command record size");
+  memcpy(&result, data, sizeof result);
+  return result;
+}
+
+/* child: find the channel by alias */
+static struct ChannelDesc *RecordChannel(struct Manifest *manifest,
+    const char *alias)
+{
+  int i;
+
+  for(i = 0; i < manifest->channels->len; ++i)
+    if(g_strcmp0(CH_CH(manifest, i)->alias, alias) == 0)
+      return CH_CH(manifest, i);
+
+  ZLOGFAIL(1, EFAULT, "unknown channel %s", alias);
+  return NULL;
+}
+
+/*
+ * child: update "manifest" with the binary command records (see
+ * daemon.txt). the channels without "source" records keep the daemon
+ * sources, the 1st "source" record of the channel drops them
+ */
+static void BinaryCommand(struct Manifest *manifest)
+{
+  GPtrArray *updated = g_ptr_array_new();
+
+  for(;;)
+  {
+    struct CommandRecord record;
+    struct ChannelDesc *channel;
+    char *data;
+    char *name;
+    int i;
+
+    ZLOGFAIL(ReadCommand(&record, sizeof record) != 0, EIO,
+        "cannot read command record");
+    ZLOGFAIL(record.size > RECORD_LIMIT, EFAULT, "too large command record");
+    data = g_malloc0(record.size + 1);
+    ZLOGFAIL(ReadCommand(data, record.size) != 0, EIO,
+        "cannot read command record");
+
+    switch(record.type)
+    {
+      case CmdEnd:
+        g_free(data);
+        g_ptr_array_free(updated, TRUE);
+        return;
+      case CmdNode:
+        manifest->node = RecordInt(data, record.size);
+        break;
+      case CmdTimeout:
+        manifest->timeout = RecordInt(data, record.size);
+        break;
+      case CmdJob:
+        manifest->job = g_strdup(data);
+        break;
+      case CmdSave:
+        manifest->save = g_strdup(data);
+        break;
+      case CmdSource:
+        name = data + strlen(data) + 1;
+        ZLOGFAIL(name > data + record.size, EFAULT, "invalid source record");
+        channel = RecordChannel(manifest, data);
+
+        /* the 1st source replaces the daemon ones */
+        for(i = 0; i < updated->len; ++i)
+          if(g_ptr_array_index(updated, i) == channel) break;
+        if(i == updated->len)
+        {
+          channel->source = g_ptr_array_new();
+          g_ptr_array_add(updated, channel);
+        }
+        ManifestSourceCtor(channel->source, name);
+        break;
+      default:
+        ZLOGFAIL(1, EFAULT, "invalid command record %u", record.type);
+        break;
+    }
+    g_free(data);
+  }
+}
+
+/*
+ * child: give the sources opened by the daemon to the read only sources
+ * with the same names. the rest of sources are mounted as usual
+ */
+static void ShareSources(struct Manifest *manifest)
+{
+  int i;
+  int j;
+  int k;
+
+  if(shared == NULL) return;
+  for(i = 0; i < manifest->channels->len; ++i)
+  {
+    struct ChannelDesc *channel = CH_CH(manifest, i);
+
+    if(!IS_RO(channel)) continue;
+    for(j = 0; j < channel->source->len; ++j)
+    {
+      struct File *file = CH_FILE(channel, j);
+
+      if(!IS_FILE(file) || IS_SHARED(file)) continue;
+      for(k = 0; k < shared->len; ++k)
+      {
+        struct File *origin = g_ptr_array_index(shared, k);
+        if(g_strcmp0(origin->name, file->name) != 0) continue;
+
+        file->protocol = origin->protocol;
+        file->handle = origin->handle;
+        file->flags |= FLAG_SHARED_MASK;
+        break;
+      }
+    }
+  }
+}
+
+/* child: update "nap" with the new manifest (text or binary command) */
+static void UpdateSession(struct Manifest *manifest)
+{
+  char prefix[CMD_SIZE];
+
+  /* set the report handle */
+  ReportMode(3);
+  SetReportHandle(client);
+
+  ZLOGFAIL(ReadCommand(prefix, CMD_SIZE) != 0, EIO, "%s", strerror(errno));
+  if(memcmp(prefix, COMMAND_MAGIC, CMD_SIZE) == 0)
+    BinaryCommand(manifest);
+  else
+    TextCommand(manifest, prefix);
+
+  /* reset timeout, i/o limit, privileges e.t.c. */
+  LastDefenseLine(manifest);
+  ShareSources(manifest);
   ChannelsCtor(manifest);
 }
 
 /* daemon: get the next task: return when accept()'ed */
-static int Job(int sock)
+static int Job()
 {
   struct sockaddr_un remote;
   socklen_t len = sizeof remote;
   return accept(sock, &remote, &len);
 }
 
+/* open the command socket "Job" */
+static void OpenJob(struct Manifest *manifest)
+{
+  struct sockaddr_un remote = {AF_UNIX, ""};
+
+  unlink(manifest->job);
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  strcpy(remote.sun_path, manifest->job);
+  ZLOGFAIL(bind(sock, &remote, sizeof remote) < 0, EIO, "%s", strerror(errno));
+  ZLOGFAIL(listen(sock, QUEUE_SIZE) < 0, EIO, "%s", strerror(errno));
+}
+
+/* daemon: return 1 if the channel is listed in "Shared" */
+static int IsShared(struct Manifest *manifest, struct ChannelDesc *channel)
+{
+  int i;
+
+  if(manifest->shared == NULL) return 0;
+  for(i = 0; manifest->shared[i] != NULL; ++i)
+    if(g_strcmp0(manifest->shared[i], channel->alias) == 0) return 1;
+  return 0;
+}
+
+/*
+ * daemon: reset the network source to the manifest address. the children
+ * bind, connect and ask the name service for their own node anew
+ */
+static void ResetConnection(struct ChannelDesc *channel, int n)
+{
+  struct Connection *c = CH_CONN(channel, n);
+
+  c->host = c->mft_host;
+  c->port = c->mft_port;
+  c->pos = 0;
+
+  /* the network stream of the child starts from the beginning */
+  channel->eof = 0;
+  channel->getpos = 0;
+  channel->putpos = 0;
+  channel->bufpos = 0;
+  channel->bufend = 0;
+}
+
+/* keep the channels sources lists, the channels destruction empties them */
+static void KeepSources(struct Manifest *manifest)
+{
+  int i;
+  int j;
+
+  kept_channels = g_ptr_array_new();
+  kept_sources = g_malloc(manifest->channels->len * sizeof *kept_sources);
+  for(i = 0; i < manifest->channels->len; ++i)
+  {
+    struct ChannelDesc *channel = CH_CH(manifest, i);
+
+    g_ptr_array_add(kept_channels, channel);
+    kept_sources[i] = g_ptr_array_new();
+    for(j = 0; j < channel->source->len; ++j)
+      g_ptr_array_add(kept_sources[i], CH_FILE(channel, j));
+  }
+}
+
+/* give the kept sources lists back, closed sources lose the handles */
+static void RestoreSources()
+{
+  int i;
+  int j;
+
+  for(i = 0; i < kept_channels->len; ++i)
+  {
+    struct ChannelDesc *channel = g_ptr_array_index(kept_channels, i);
+
+    g_ptr_array_free(channel->source, TRUE);
+    channel->source = g_ptr_array_new();
+    for(j = 0; j < kept_sources[i]->len; ++j)
+    {
+      g_ptr_array_add(channel->source, g_ptr_array_index(kept_sources[i], j));
+      if(IS_SHARED(CH_FILE(channel, j))) continue;
+      CH_HANDLE(channel, j) = NULL;
+      CH_FLAGS(channel, j) &= ~FLAG_VALID_MASK;
+      if(IS_NETWORK(CH_CONN(channel, j)))
+        ResetConnection(channel, j);
+    }
+  }
+}
+
+/*
+ * daemon: unmount channels keeping the sources list for the children
+ * (binary command can omit them). the "Shared" channels sources stay open.
+ * the network sources (and the context) belong to the user session
+ */
+static void UnmountChannels(struct Manifest *manifest)
+{
+  int i;
+  int j;
+
+  KeepSources(manifest);
+  shared = g_ptr_array_new();
+  for(i = 0; i < manifest->channels->len; ++i)
+  {
+    struct ChannelDesc *channel = CH_CH(manifest, i);
+
+    if(!IsShared(manifest, channel)) continue;
+    ZLOGFAIL(!IS_RO(channel), EFAULT, "%s cannot be shared", channel->alias);
+    for(j = 0; j < channel->source->len; ++j)
+    {
+      ZLOGFAIL(CH_PROTO(channel, j) != ProtoRegular, EFAULT,
+          "%s source %d cannot be shared", channel->alias, j);
+      CH_FLAGS(channel, j) |= FLAG_SHARED_MASK;
+      g_ptr_array_add(shared, CH_FILE(channel, j));
+    }
+  }
+
+  ChannelsNetDetach(manifest);
+  ChannelsDtor(manifest);
+  RestoreSources();
+}
+
+/* daemon (warm): open the "Shared" channels sources, the rest stay closed */
+static void OpenShared(struct Manifest *manifest)
+{
+  int i;
+  int j;
+
+  shared = g_ptr_array_new();
+  for(i = 0; i < manifest->channels->len; ++i)
+  {
+    struct ChannelDesc *channel = CH_CH(manifest, i);
+
+    if(!IsShared(manifest, channel)) continue;
+    ZLOGFAIL(!IS_RO(channel), EFAULT, "%s cannot be shared", channel->alias);
+    for(j = 0; j < channel->source->len; ++j)
+    {
+      struct File *file = CH_FILE(channel, j);
+      struct stat fs;
+      int h;
+
+      ZLOGFAIL(!IS_FILE(file), EFAULT,
+          "%s source %d cannot be shared", channel->alias, j);
+      h = open(file->name, O_RDONLY);
+      ZLOGFAIL(h < 0 || fstat(h, &fs) != 0 || !S_ISREG(fs.st_mode), EFAULT,
+          "%s source %d cannot be shared", channel->alias, j);
+
+      file->protocol = ProtoRegular;
+      file->handle = GINT_TO_POINTER(h);
+      file->flags |= FLAG_SHARED_MASK;
+      g_ptr_array_add(shared, file);
+    }
+  }
+}
+
 /* convert to the daemon mode */
-static int Daemonize(struct NaClApp *nap)
+static void Daemonize(struct NaClApp *nap)
 {
   char *bname;
   char *name;
-  int sock;
+  sigset_t set;
   struct sigaction sa;
-  struct sockaddr_un remote = {AF_UNIX, ""};
 
-  /* unmount channels, reset timeout */
-  ChannelsDtor(nap->manifest);
+  /* unmount channels (warm daemon has nothing mounted), reset timeout */
+  if(warm)
+    OpenShared(nap->manifest);
+  else
+    UnmountChannels(nap->manifest);
   nap->manifest->timeout = 0;
   alarm(0);
 
@@ -153,11 +544,23 @@ static int Daemonize(struct NaClApp *nap)
   ZLOGFAIL(dup(0) != 2, EFAULT, "can't set stderr to /dev/null");
 
   /* open the command channel */
-  unlink(nap->manifest->job);
-  sock = socket(AF_UNIX, SOCK_STREAM, 0);
-  strcpy(remote.sun_path, nap->manifest->job);
-  ZLOGFAIL(bind(sock, &remote, sizeof remote) < 0, EIO, "%s", strerror(errno));
-  ZLOGFAIL(listen(sock, QUEUE_SIZE) < 0, EIO, "%s", strerror(errno));
+  OpenJob(nap->manifest);
+
+  /* finished children are reaped upon SIGCHLD */
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  ZLOGFAIL(sigprocmask(SIG_BLOCK, &set, NULL) != 0, errno,
+      "can't block SIGCHLD");
+  events = signalfd(-1, &set, SFD_NONBLOCK);
+  ZLOGFAIL(events < 0, errno, "can't create signalfd");
+
+  /* spare children channels */
+  if(nap->manifest->pool > 0)
+  {
+    ZLOGFAIL(pipe(notify) != 0, errno, "can't create pool pipe");
+    ZLOGFAIL(fcntl(notify[0], F_SETFL, O_NONBLOCK) != 0, errno,
+        "can't set pool pipe");
+  }
 
   /* set name for daemon */
   bname = g_path_get_basename(nap->manifest->job);
@@ -168,17 +571,247 @@ static int Daemonize(struct NaClApp *nap)
 
   /* TODO(d'b): free needless resources */
   SetCmdString(g_string_new("command = daemonic"));
-  return sock;
+}
+
+/* child: account the time the request spent in the daemon queue */
+static void SetQueued(int64_t time)
+{
+  SetQueueTime(g_get_monotonic_time() - time);
+}
+
+/* daemon: pass the request to the spare child */
+static int SendRequest(struct Spare *spare, struct Request *request)
+{
+  char buf[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = {&request->time, sizeof request->time};
+  struct msghdr msg = {0};
+  struct cmsghdr *cmsg;
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = buf;
+  msg.msg_controllen = sizeof buf;
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &request->client, sizeof(int));
+
+  return sendmsg(spare->job, &msg, 0) == sizeof request->time ? 0 : -1;
+}
+
+/* spare child: wait for the request from the daemon */
+static void ReceiveRequest(struct Request *request)
+{
+  char buf[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = {&request->time, sizeof request->time};
+  struct msghdr msg = {0};
+  struct cmsghdr *cmsg;
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = buf;
+  msg.msg_controllen = sizeof buf;
+
+  for(;;)
+  {
+    ssize_t code = recvmsg(job, &msg, 0);
+    cmsg = CMSG_FIRSTHDR(&msg);
+
+    if(code == sizeof request->time && cmsg != NULL
+        && cmsg->cmsg_type == SCM_RIGHTS) break;
+    ZLOGFAIL(code < 0 && errno != EINTR, EIO, "%s", strerror(errno));
+  }
+  memcpy(&request->client, CMSG_DATA(cmsg), sizeof(int));
+}
+
+/*
+ * spare child: prepare the network, wait for the request and tell the
+ * daemon which child took it. return when the request received
+ */
+static void Spare(struct Manifest *manifest)
+{
+  struct Request request;
+  pid_t pid = getpid();
+
+  ResetSession();
+  NetPrepare(manifest);
+  ReceiveRequest(&request);
+  client = request.client;
+  SetQueued(request.time);
+
+  ZLOGIF(write(notify[1], &pid, sizeof pid) != sizeof pid,
+      "cannot notify daemon: %s", strerror(errno));
+  close(notify[1]);
+  close(job);
+}
+
+/*
+ * daemon: serve requests. the requests are accepted to the queue and
+ * started while the running sessions number is below "Sessions": by the
+ * spare children if "Pool" specified or by the forked ones. the children
+ * are reaped upon SIGCHLD. return -1 in the child (continue to the trap)
+ */
+static int Serve(struct NaClApp *nap)
+{
+  int pending = 0; /* requests sent to spares but not taken yet */
+  int running = 0; /* children serving requests */
+  int limit = nap->manifest->sessions;
+
+  for(;;)
+  {
+    struct pollfd fds[] = {
+        {sock, POLLIN}, {events, POLLIN}, {notify[0], POLLIN}};
+    struct signalfd_siginfo info;
+    siginfo_t child;
+    pid_t pid;
+    int pair[2];
+    int stuck;
+    int i;
+
+    /* fill the pool up. each spare has own requests socket */
+    while(idle < nap->manifest->pool)
+    {
+      if(socketpair(AF_UNIX, SOCK_DGRAM, 0, pair) != 0)
+      {
+        ZLOG(LOG_ERROR, "can't create pool socket: %s", strerror(errno));
+        break;
+      }
+
+      pid = fork();
+      if(pid == 0)
+      {
+        close(pair[0]);
+        job = pair[1];
+        Spare(nap->manifest);
+        UpdateSession(nap->manifest);
+        if(!warm) SetChannelsState(nap);
+        return -1;
+      }
+
+      close(pair[1]);
+      if(pid < 0)
+      {
+        close(pair[0]);
+        ZLOG(LOG_ERROR, "fork failed: %s", strerror(errno));
+        break;
+      }
+      spares[idle].pid = pid;
+      spares[idle].job = pair[0];
+      spares[idle].sent = 0;
+      ++idle;
+    }
+
+    /* start the queued requests */
+    while(queued > 0 && (limit == 0 || running + pending < limit))
+    {
+      struct Request *request = &queue[head];
+
+      if(nap->manifest->pool > 0)
+      {
+        for(i = 0; i < idle; ++i)
+          if(!spares[i].sent) break;
+        if(i == idle || SendRequest(&spares[i], request) != 0) break;
+        spares[i].sent = 1;
+        ++pending;
+      }
+      else
+      {
+        /* child: update manifest, continue to the trap */
+        pid = fork();
+        if(pid == 0)
+        {
+          client = request->client;
+          ResetSession();
+          SetQueued(request->time);
+          UpdateSession(nap->manifest);
+          if(!warm) SetChannelsState(nap);
+          return -1;
+        }
+
+        if(pid < 0)
+        {
+          ZLOG(LOG_ERROR, "fork failed: %s", strerror(errno));
+          break;
+        }
+        ++running;
+      }
+
+      /* daemon: close command socket */
+      close(request->client);
+      head = (head + 1) % QUEUE_LIMIT;
+      --queued;
+    }
+
+    /*
+     * wait for a new request, a spare taking the request or a child exit.
+     * the request not started because of failed fork is retried later
+     */
+    stuck = queued > 0 && (limit == 0 || running + pending < limit);
+    if(queued == QUEUE_LIMIT) fds[0].fd = -1;
+    if(poll(fds, ARRAY_SIZE(fds), stuck ? RETRY_TIMEOUT : -1) < 0)
+    {
+      ZLOGIF(errno != EINTR, "%s", strerror(errno));
+      continue;
+    }
+
+    /* get the next job */
+    if(fds[0].revents & POLLIN)
+    {
+      struct Request *request = &queue[(head + queued) % QUEUE_LIMIT];
+
+      request->client = Job();
+      request->time = g_get_monotonic_time();
+      if(request->client < 0)
+        ZLOG(LOG_ERROR, "%s", strerror(errno));
+      else
+        ++queued;
+    }
+
+    /* spare children took the requests (the died ones are already gone) */
+    while(read(notify[0], &pid, sizeof pid) == sizeof pid)
+    {
+      for(i = 0; i < idle; ++i)
+        if(spares[i].pid == pid) break;
+      if(i == idle) continue;
+      close(spares[i].job);
+      spares[i] = spares[--idle];
+      --pending;
+      ++running;
+    }
+
+    /* release finished child sessions */
+    while(read(events, &info, sizeof info) == sizeof info);
+    for(;;)
+    {
+      child.si_pid = 0;
+      if(waitid(P_ALL, 0, &child, WEXITED | WNOHANG) < 0) break;
+      if(child.si_pid == 0) break;
+
+      /*
+       * spare child died before taking the request or before telling the
+       * daemon about it. the request sent to it is lost
+       */
+      for(i = 0; i < idle; ++i)
+        if(spares[i].pid == child.si_pid) break;
+      if(i < idle)
+      {
+        pending -= spares[i].sent;
+        close(spares[i].job);
+        spares[i] = spares[--idle];
+      }
+      else
+        --running;
+    }
+  }
 }
 
 int Daemon(struct NaClApp *nap)
 {
   pid_t pid;
-  siginfo_t info;
-  int sock;
 
-  /* can the daemon be started? */
-  if(nap->manifest->job == NULL) return -1;
+  /* can the daemon be started? the recycled session ignores zvm_fork */
+  if(nap->manifest->job == NULL || recycling) return -1;
   ZLOGFAIL(GetExitCode(), EFAULT, "broken session");
 
   /* report the daemon mode launched */
@@ -191,34 +824,93 @@ int Daemon(struct NaClApp *nap)
 
   /* forked sessions are not in daemon mode */
   SetDaemonState(0);
-  sock = Daemonize(nap);
+  Daemonize(nap);
+  spares = g_malloc(nap->manifest->pool * sizeof *spares);
+  return Serve(nap);
+}
 
-  for(;;)
-  {
-    /* get the next job */
-    if((client = Job(sock)) < 0)
-    {
-      ZLOG(LOG_ERROR, "%s", strerror(errno));
-      continue;
-    }
+int WarmDaemon(struct NaClApp *nap)
+{
+  int i;
 
-    /* release waiting child sessions */
-    do
-      if(waitid(P_ALL, 0, &info, WEXITED | WNOHANG) < 0) break;
-    while(info.si_code);
+  warm = 1;
+  if(Daemon(nap) != 0) return -1;
 
-    /* child: update manifest, continue to the trap */
-    pid = fork();
-    if(pid == 0)
-    {
-      UpdateSession(nap->manifest);
-      break;
-    }
+  /* the launching session has nothing mounted */
+  for(i = 0; i < nap->manifest->channels->len; ++i)
+    g_ptr_array_set_size(CH_CH(nap->manifest, i)->source, 0);
+  return 0;
+}
+
+/* recycling: reset the channels of the finished session */
+static void ResetChannels(struct Manifest *manifest)
+{
+  int i;
 
-    /* daemon: close command socket and wait for a new job */
-    close(client);
-    ZLOGIF(pid < 0, "fork failed: %s", strerror(errno));
+  RestoreSources();
+  for(i = 0; i < manifest->channels->len; ++i)
+  {
+    struct ChannelDesc *channel = CH_CH(manifest, i);
+
+    channel->eof = 0;
+    channel->size = 0;
+    channel->getpos = 0;
+    channel->putpos = 0;
+    channel->bufpos = 0;
+    channel->bufend = 0;
+    memset(channel->counters, 0, sizeof channel->counters);
+
+    /* the digests are calculated from scratch */
+    if(channel->tag == NULL) continue;
+    TagDtor(channel->tag);
+    channel->tag = TagCtor();
   }
 
-  return -1;
+  if(manifest->mem_tag == NULL) return;
+  TagDtor(manifest->mem_tag);
+  manifest->mem_tag = TagCtor();
+}
+
+/* recycling: wait for the next request and mount its channels */
+static void NextJob(struct Manifest *manifest)
+{
+  for(client = Job(); client < 0; client = Job())
+    ZLOGFAIL(errno != EINTR && errno != ECONNABORTED, EIO,
+        "%s", strerror(errno));
+  UpdateSession(manifest);
+}
+
+void RecycleCtor(struct NaClApp *nap)
+{
+  recycling = 1;
+  KeepUserMemory(nap);
+  KeepSources(nap->manifest);
+  OpenShared(nap->manifest);
+  OpenJob(nap->manifest);
+  NextJob(nap->manifest);
+}
+
+void RecycleSession(struct NaClApp *nap)
+{
+  /* only the clean session alone in the process can be recycled */
+  if(!recycling || GetExitCode() != 0 || ThreadsCount() > 0) return;
+  SpawnDtor();
+
+  /* report to the client, stop the timeout */
+  ReportSession(nap);
+  close(client);
+  alarm(0);
+
+  /* reset the sandbox and the trusted state */
+  ResetUserMemory(nap);
+  ResetChannels(nap->manifest);
+  SessionForget();
+  ResetAccounting();
+  ZTrace("[session recycling]");
+
+  /* start the next session from the entry point */
+  NextJob(nap->manifest);
+  PrefaultWait();
+  SetSystemData(nap);
+  RestartSession(nap);
 }
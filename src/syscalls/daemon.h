@@ -26,4 +26,24 @@
  */
 int Daemon(struct NaClApp *nap);
 
+/*
+ * convert the loaded but not started session to daemon mode ("Warm" in
+ * manifest). the channels are not mounted. the spawned session returns with
+ * the channels of the request mounted to start the program from the entry
+ * point. return 0 to finalize the session, -1 to continue the session
+ */
+int WarmDaemon(struct NaClApp *nap);
+
+/*
+ * prepare the session recycling ("Recycle" in manifest): keep the loaded
+ * program memory, open "Job" and mount the channels of the 1st request
+ */
+void RecycleCtor(struct NaClApp *nap);
+
+/*
+ * report the finished session and start the session of the next request
+ * in the same process. return if the session cannot be recycled
+ */
+void RecycleSession(struct NaClApp *nap);
+
 #endif /* DAEMON_H_ */
@@ -15,50 +15,153 @@
  */
 
 /*
- * TODO(d'b): design (under construction)
- * image consist of 4 main parts:
- * 1. user memory map (for mprotect()'ion)
- * 2. user memory dump
- * 3. user context (registers) + user_ret (user entry point)
- * 4. manifest (text file, variable size, ends with eof)
+ * session image consists of:
+ * 1. header: user space layout, user context, records numbers
+ * 2. user memory map (for mprotect()'ion), see struct Region
+ * 3. user memory dump records (not zero pages only), see struct Extent
+ * 4. channels positions and counters, see struct Position
+ * 5. channels description (text) to check the new manifest up
+ * 6. user memory dump (page aligned)
+ * the trampoline is not saved: it is specific for zerovm instance
  *
- * to save image
- * - check session status (should be "ok")
- * - check "Save" value
- * - catch TrapSave (drop, hold, shot, snap)
- * - store all mentioned above data into the file
+ * to save image (TrapSave, SIGPWR or "Checkpoint" interval, see trap.c)
+ * - the session must have no threads, "Save" must be set
+ * - the memory map is taken from the system
+ * - the image is written to the temporary file and renamed
  *
- * to restore image (zerovm initialization as usual)
- * - allocate user space
- * - read (to user space) memory map (it is 64kb)
- * - read (to user space) memory dump until hole (infer from map)
- * - read (to user space) the rest (user manifest and stack)
- * - read user context and initialize nacl_sys
- * - reconstruct nap from data above (nap->sysret to TrapSave retcode)
- * - return to user code (user_ret from image contain entry point)
+ * the checkpoints (SIGPWR or "Checkpoint") are incremental: the 1st one
+ * is the full (base) image "Save", the next ones are the deltas "Save.1",
+ * "Save.2", .. holding only the pages dirtied since the previous image
+ * (the kernel soft-dirty bits) and the released (zero) pages. the deltas
+ * carry the base id, so the stale ones are never replayed. zvm_save()
+ * always writes the full image and removes the deltas
  *
- * CHANGES IN ZEROVM DESIGN
- * - main() loading of program with all checks allocations should be wrapped and carried out
- * - CreateSession() should not set user stack and affected things
- * - add manifest text to nap or manifest
+ * to restore image (zerovm initialization as usual)
+ * - LoadSession(): allocate user space, install trampoline
+ * - RestoreSession() (after channels construction): map (or read) the
+ *   memory dump of the base and replay the deltas, check channels up,
+ *   validate executable memory, restore protection and channels positions
+ * - the user manifest is rebuilt for the new channels (SetSystemData())
+ * - ResumeSession(): return to the user code from the saving trap
  */
 #include <stdio.h>
+#include <stddef.h>
 #include <assert.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include "src/loader/sel_ldr.h"
-#include "src/main/zlog.h"
+#include "src/main/setup.h"
+#include "src/platform/sel_memory.h"
+#include "src/channels/channel.h"
+#include "src/syscalls/switch_to_app.h"
 #include "src/syscalls/snapshot.h"
 
+#define MAGIC 0x31305345534d565aULL /* "ZVMSES01" */
+#define MAPS "/proc/self/maps"
+#define PAGEMAP "/proc/self/pagemap"
+#define CLEAR_REFS "/proc/self/clear_refs"
+#define CLEAR_SOFT_DIRTY "4"
+#define PAGEMAP_BATCH 0x200
+#define PAGE_PRESENT (1ULL << 63)
+#define PAGE_SWAPPED (1ULL << 62)
+#define PAGE_SOFT_DIRTY (1ULL << 55)
+#define PROT_FILE 0x100 /* internal: the region is file backed, not saved */
+#define ZERO_PAGES 0 /* extent offset of the zero pages (delta only) */
+#define DUMP_PAGES 1 /* extent offset until the image layout is known */
+#define MAPS_LINE 0x1000
+#define CHANNELS_LIMIT 0x80000 /* the manifest size limit */
+
+struct Header {
+  uint64_t magic;
+  uint64_t base; /* id of the base image */
+  uint64_t generation; /* 0 - base image, 1.. - delta number */
+  uint64_t mem_start; /* user space of the saved session */
+  uint64_t static_text_end;
+  uint64_t dynamic_text_start;
+  uint64_t dynamic_text_end;
+  uint64_t rodata_start;
+  uint64_t data_start;
+  uint64_t data_end;
+  uint64_t break_addr;
+  uint64_t initial_entry_pt;
+  uint64_t heap_end;
+  uint64_t stack_size;
+  int64_t mem_size;
+  struct ThreadContext context; /* sysret is the trap result */
+  uint32_t regions;
+  uint32_t extents;
+  uint32_t positions; /* channels number */
+  uint32_t channels; /* channels description size */
+};
+
+/* memory map record (user addresses) */
+struct Region {
+  uint64_t start;
+  uint64_t size;
+  int64_t prot;
+};
+
+/* memory dump record (user address, image position or ZERO_PAGES) */
+struct Extent {
+  uint64_t start;
+  uint64_t size;
+  uint64_t offset;
+};
+
+/* channel record (the manifest order) */
+struct Position {
+  int64_t getpos;
+  int64_t counters[LimitsNumber];
+};
+
+static volatile sig_atomic_t save_requested = 0;
+static int64_t next_checkpoint = 0; /* monotonic time (usec) or 0 */
+static uint64_t base_id = 0; /* the last saved base image id */
+static uint64_t generation = 0; /* the last saved image number */
+static int tracking = 0; /* soft-dirty bits are cleared upon the last image */
+static int mapped = 0; /* the user memory is mapped from the image */
+static char *session = NULL; /* the restored base image name */
 static int image = -1;
+static struct Header header;
+static struct Region *regions = NULL;
+static struct Extent *extents = NULL;
+static struct Position *positions = NULL;
+static char *channels = NULL;
+
+/* read "size" bytes from "offset" of the image. 0: success, -1: failed */
+static int ReadImage(void *buffer, int64_t size, off_t offset)
+{
+  while(size > 0)
+  {
+    ssize_t code = pread(image, buffer, MIN(size, SSIZE_MAX), offset);
+    if(code <= 0) return -1;
+    buffer = (char*)buffer + code;
+    offset += code;
+    size -= code;
+  }
+  return 0;
+}
+
+/* write "size" bytes to "fd". 0: success, -1: failed */
+static int WriteAll(int fd, const void *buffer, int64_t size)
+{
+  while(size > 0)
+  {
+    ssize_t code = write(fd, buffer, MIN(size, SSIZE_MAX));
+    if(code <= 0) return -1;
+    buffer = (const char*)buffer + code;
+    size -= code;
+  }
+  return 0;
+}
 
 /*
  * return 0: given file contains session, -1: random file
  * note: initializes image handler
  */
-#define MAGIC 0x3030474d494d565aULL
 static int IsImage(const char *name)
 {
   uint64_t magic = 0;
-  int code;
 
   /* open image */
   if(image < 0)
@@ -66,110 +169,737 @@ static int IsImage(const char *name)
   if(image < 0) return -1;
 
   /* read "magic" */
-  code = read(image, &magic, sizeof magic);
-  return code == sizeof magic ? magic == MAGIC ? 0 : -1 : -1;
+  if(ReadImage(&magic, sizeof magic, 0) == 0 && magic == MAGIC) return 0;
+  close(image);
+  image = -1;
+  return -1;
 }
 
-/* get memory map from system */
-static void *GetSystemMemoryMap()
+/* channels description (one line per channel) */
+static char *ChannelsDescription(struct Manifest *manifest)
 {
-  return NULL;
+  GString *text = g_string_new(NULL);
+  int i;
+
+  for(i = 0; i < manifest->channels->len; ++i)
+  {
+    struct ChannelDesc *channel = CH_CH(manifest, i);
+    g_string_append_printf(text, "%s, %d, %ld, %ld, %ld, %ld\n",
+        channel->alias, channel->type, channel->limits[GetsLimit],
+        channel->limits[GetSizeLimit], channel->limits[PutsLimit],
+        channel->limits[PutSizeLimit]);
+  }
+  return g_string_free(text, FALSE);
 }
 
-/* save memory map to image */
-static int SaveMemoryMap(void *map)
+/* channels positions and counters (should be g_free later) */
+static struct Position *ChannelsPositions(struct Manifest *manifest)
 {
-  return -1;
+  struct Position *records;
+  int i;
+
+  records = g_malloc0(manifest->channels->len * sizeof *records);
+  for(i = 0; i < manifest->channels->len; ++i)
+  {
+    struct ChannelDesc *channel = CH_CH(manifest, i);
+    records[i].getpos = channel->getpos;
+    memcpy(records[i].counters, channel->counters, sizeof records[i].counters);
+  }
+  return records;
 }
 
-/* save 1st part of user memory dump to image */
-static int SaveMemory1(struct NaClApp *nap, void *map)
+/*
+ * get memory map of the user space above the trampoline from system. the
+ * file backed regions (mapped image, channels state) are marked PROT_FILE
+ */
+static GArray *GetSystemMemoryMap(struct NaClApp *nap)
 {
-  return -1;
+  GArray *map;
+  FILE *maps;
+  char line[MAPS_LINE];
+
+  maps = fopen(MAPS, "r");
+  if(maps == NULL) return NULL;
+
+  map = g_array_new(FALSE, FALSE, sizeof(struct Region));
+  while(fgets(line, sizeof line, maps) != NULL)
+  {
+    struct Region region;
+    uintptr_t start;
+    uintptr_t end;
+    unsigned long inode;
+    char perms[5];
+
+    if(sscanf(line, "%lx-%lx %4s %*x %*s %lu",
+        &start, &end, perms, &inode) != 4) continue;
+    start = MAX(start, nap->mem_start + NACL_TRAMPOLINE_END);
+    end = MIN(end, nap->mem_start + FOURGIG);
+    if(start >= end) continue;
+
+    region.start = start - nap->mem_start;
+    region.size = end - start;
+    region.prot = (perms[0] == 'r' ? PROT_READ : 0)
+        | (perms[1] == 'w' ? PROT_WRITE : 0)
+        | (perms[2] == 'x' ? PROT_EXEC : 0)
+        | (inode != 0 ? PROT_FILE : 0);
+    g_array_append_val(map, region);
+  }
+  fclose(maps);
+  return map;
 }
 
-/* save 2nd part of user memory dump to image */
-static int SaveMemory2(struct NaClApp *nap, void *map)
+/*
+ * get page table entries of "count" pages from "addr" (present and dirty
+ * if unknown)
+ */
+static void GetPageEntries(int pagemap, uintptr_t addr, uint64_t *entries, int count)
 {
-  return -1;
+  ssize_t size = count * sizeof *entries;
+  int i;
+
+  if(pagemap >= 0 && pread(pagemap, entries, size,
+      addr / NACL_PAGESIZE * sizeof *entries) == size) return;
+  for(i = 0; i < count; ++i)
+    entries[i] = PAGE_PRESENT | PAGE_SOFT_DIRTY;
 }
 
-/* save user context to image */
-static int SaveUserContext(struct NaClApp *nap)
+/* return 1 if the page contains only zeroes */
+static int IsZeroPage(const uint64_t *page)
 {
-  return -1;
+  int i;
+
+  for(i = 0; i < NACL_PAGESIZE / sizeof *page; ++i)
+    if(page[i] != 0) return 0;
+  return 1;
 }
 
-/* save text manifest to image */
-static int SaveManifest(struct NaClApp *nap)
+/* append the page to the last record of the same kind or start the new one */
+static void AppendPage(GArray *dump, uint64_t start, uint64_t offset)
 {
-  return -1;
-}
+  struct Extent *last = NULL;
 
-/* .. */
+  if(dump->len > 0)
+    last = &g_array_index(dump, struct Extent, dump->len - 1);
+  if(last != NULL && last->start + last->size == start
+      && last->offset == offset)
+    last->size += NACL_PAGESIZE;
+  else
+  {
+    struct Extent extent = {start, NACL_PAGESIZE, offset};
+    g_array_append_val(dump, extent);
+  }
+}
 
-/* load memory map from image to user space */
-static void *LoadMemoryMap(struct NaClApp *nap)
+/*
+ * get dump records of readable regions from "map": not zero pages (base
+ * image) or pages changed since the previous image (delta)
+ */
+static GArray *GetMemoryDump(struct NaClApp *nap, GArray *map, int incremental)
 {
-  return NULL;
+  uint64_t entries[PAGEMAP_BATCH];
+  GArray *dump;
+  int pagemap;
+  int i;
+
+  dump = g_array_new(FALSE, FALSE, sizeof(struct Extent));
+  pagemap = open(PAGEMAP, O_RDONLY);
+
+  for(i = 0; i < map->len; ++i)
+  {
+    struct Region *region = &g_array_index(map, struct Region, i);
+    uintptr_t start = nap->mem_start + region->start;
+    uintptr_t end = start + region->size;
+    uintptr_t addr;
+
+    if((region->prot & PROT_READ) == 0) continue;
+    for(addr = start; addr < end; addr += NACL_PAGESIZE)
+    {
+      uint64_t page = addr - nap->mem_start;
+      int j = (addr - start) / NACL_PAGESIZE % PAGEMAP_BATCH;
+      int touched;
+
+      if(j == 0)
+        GetPageEntries(pagemap, addr, entries,
+            MIN(PAGEMAP_BATCH, (end - addr) / NACL_PAGESIZE));
+      touched = (entries[j] & (PAGE_PRESENT | PAGE_SWAPPED)) != 0;
+
+      /* never touched (or released) anonymous pages are zero */
+      if(!touched && (region->prot & PROT_FILE) == 0)
+      {
+        if(incremental) AppendPage(dump, page, ZERO_PAGES);
+        continue;
+      }
+
+      /* the file pages not copied yet keep the content of the base image */
+      if(incremental)
+      {
+        if(touched && (entries[j] & PAGE_SOFT_DIRTY) != 0)
+          AppendPage(dump, page, DUMP_PAGES);
+        continue;
+      }
+
+      if(!IsZeroPage((uint64_t*)addr)) AppendPage(dump, page, DUMP_PAGES);
+    }
+  }
+
+  if(pagemap >= 0) close(pagemap);
+  return dump;
 }
 
-/* load 1st part of memory dump from image to user space */
-static void LoadMemory1(struct NaClApp *nap, void *map)
+/* write the image to "fd". 0: success, -1: failed */
+static int WriteImage(int fd, struct Header *hdr, GArray *map,
+    GArray *dump, struct Position *records, char *description)
 {
+  uint64_t offset;
+  int i;
+
+  /* the memory dump is page aligned, so it can be mapped */
+  offset = ROUNDUP_4K(sizeof *hdr + map->len * sizeof(struct Region)
+      + dump->len * sizeof(struct Extent)
+      + hdr->positions * sizeof *records + hdr->channels);
+  for(i = 0; i < dump->len; ++i)
+  {
+    struct Extent *extent = &g_array_index(dump, struct Extent, i);
+
+    if(extent->offset == ZERO_PAGES) continue;
+    extent->offset = offset;
+    offset += extent->size;
+  }
+
+  if(WriteAll(fd, hdr, sizeof *hdr) != 0
+      || WriteAll(fd, map->data, map->len * sizeof(struct Region)) != 0
+      || WriteAll(fd, dump->data, dump->len * sizeof(struct Extent)) != 0
+      || WriteAll(fd, records, hdr->positions * sizeof *records) != 0
+      || WriteAll(fd, description, hdr->channels) != 0) return -1;
+
+  for(i = 0; i < dump->len; ++i)
+  {
+    struct Extent *extent = &g_array_index(dump, struct Extent, i);
+
+    if(extent->offset == ZERO_PAGES) continue;
+    if(lseek(fd, extent->offset, SEEK_SET) < 0) return -1;
+    if(WriteAll(fd, (void*)(hdr->mem_start + extent->start), extent->size) != 0)
+      return -1;
+  }
+  return 0;
 }
 
-/* load 2nd part of memory dump from image to user space */
-static void LoadMemory2(struct NaClApp *nap, void *map)
+/*
+ * clear the soft-dirty bits of zerovm pages. the kernel without soft-dirty
+ * support accepts the clearing too, so the written probe page must show
+ * the bit. 0: the pages are tracked, -1: failed (full images only)
+ */
+static int ClearSoftDirty()
 {
+  static volatile char *probe = NULL;
+  uint64_t entry = 0;
+  ssize_t code;
+  int fd;
+
+  if(probe == NULL)
+  {
+    void *p = mmap(NULL, NACL_PAGESIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED) return -1;
+    probe = p;
+  }
+
+  fd = open(CLEAR_REFS, O_WRONLY);
+  if(fd < 0) return -1;
+  code = write(fd, CLEAR_SOFT_DIRTY, sizeof CLEAR_SOFT_DIRTY - 1);
+  close(fd);
+  if(code != sizeof CLEAR_SOFT_DIRTY - 1) return -1;
+
+  /* the page written after the clearing must be soft-dirty */
+  *probe = 1;
+  fd = open(PAGEMAP, O_RDONLY);
+  if(fd < 0) return -1;
+  code = pread(fd, &entry, sizeof entry,
+      (uintptr_t)probe / NACL_PAGESIZE * sizeof entry);
+  close(fd);
+  return code == sizeof entry && (entry & PAGE_SOFT_DIRTY) != 0 ? 0 : -1;
 }
 
-/* load user context from image to user space */
-static void LoadUserContext(struct NaClApp *nap)
+/* remove the deltas of the base image "name" */
+static void RemoveDeltas(const char *name)
 {
+  uint64_t n;
+
+  for(n = 1;; ++n)
+  {
+    char *delta = g_strdup_printf("%s.%lu", name, n);
+    int code = unlink(delta);
+
+    g_free(delta);
+    if(code != 0) break;
+  }
 }
 
-/* read old manifest from image, and check it up against the new one */
-static void CheckManifest(struct NaClApp *nap)
+/* set the time of the next checkpoint (if "Checkpoint" specified) */
+static void ScheduleCheckpoint(struct Manifest *manifest)
 {
+  if(manifest->checkpoint > 0)
+    next_checkpoint = g_get_monotonic_time()
+        + (int64_t)manifest->checkpoint * G_USEC_PER_SEC;
 }
 
-int SaveSession(struct NaClApp *nap)
+int SaveSession(struct NaClApp *nap, int incremental)
 {
+  struct Header hdr = {MAGIC};
+  GArray *map;
+  GArray *dump;
+  struct Position *records;
+  char *description;
+  char *name;
+  char *tmp;
+  int fd;
   int code;
-  void *map;
+  int i;
 
-  map = GetSystemMemoryMap();
-  if(map == NULL) return -1;
+  assert(nap != NULL);
+  assert(nap->manifest != NULL);
 
-  code = SaveMemoryMap(map);
-  if(code < 0) return -1;
+  save_requested = 0;
+  ScheduleCheckpoint(nap->manifest);
+  if(nap->manifest->save == NULL) return -EPERM;
 
-  code = SaveMemory1(nap, map);
-  if(code < 0) return -1;
+  /* the delta needs the base image and the soft-dirty bits cleared upon it */
+  incremental = incremental && tracking;
+  map = GetSystemMemoryMap(nap);
+  if(map == NULL) return -EIO;
+  dump = GetMemoryDump(nap, map, incremental);
+  for(i = 0; i < map->len; ++i)
+    g_array_index(map, struct Region, i).prot &= ~PROT_FILE;
+  records = ChannelsPositions(nap->manifest);
+  description = ChannelsDescription(nap->manifest);
 
-  code = SaveMemory2(nap, map);
-  if(code < 0) return -1;
+  hdr.base = incremental ? base_id
+      : ((uint64_t)g_random_int() << 32 | g_random_int()) | 1;
+  hdr.generation = incremental ? generation + 1 : 0;
+  hdr.mem_start = nap->mem_start;
+  hdr.static_text_end = nap->static_text_end;
+  hdr.dynamic_text_start = nap->dynamic_text_start;
+  hdr.dynamic_text_end = nap->dynamic_text_end;
+  hdr.rodata_start = nap->rodata_start;
+  hdr.data_start = nap->data_start;
+  hdr.data_end = nap->data_end;
+  hdr.break_addr = nap->break_addr;
+  hdr.initial_entry_pt = nap->initial_entry_pt;
+  hdr.heap_end = nap->heap_end;
+  hdr.stack_size = nap->stack_size;
+  hdr.mem_size = nap->manifest->mem_size;
+  hdr.context = *nacl_user;
+  hdr.regions = map->len;
+  hdr.extents = dump->len;
+  hdr.positions = nap->manifest->channels->len;
+  hdr.channels = strlen(description);
+  name = incremental
+      ? g_strdup_printf("%s.%lu", nap->manifest->save, hdr.generation)
+      : g_strdup(nap->manifest->save);
 
-  code = SaveUserContext(nap);
-  if(code < 0) return -1;
+  /* write the temporary file and rename it (atomic update) */
+  tmp = g_strconcat(name, ".XXXXXX", NULL);
+  fd = g_mkstemp_full(tmp, O_WRONLY, S_IRUSR | S_IWUSR);
+  code = fd < 0 ? -1 : WriteImage(fd, &hdr, map, dump, records, description);
+  if(fd >= 0 && close(fd) != 0) code = -1;
+  if(code == 0 && !incremental) RemoveDeltas(nap->manifest->save);
+  if(code == 0 && rename(tmp, name) != 0) code = -1;
+  if(code != 0 && fd >= 0) unlink(tmp);
 
-  code = SaveManifest(nap);
-  if(code < 0) return -1;
+  /* the next delta holds the pages dirtied since this image */
+  if(code == 0)
+  {
+    base_id = hdr.base;
+    generation = hdr.generation;
+    tracking = ClearSoftDirty() == 0;
+  }
+  else if(!incremental)
+    tracking = 0;
 
-  return 0;
+  ZLOGIF(code != 0, "cannot save session to %s", name);
+  ZLOGS(LOG_DEBUG, "session saved to %s: %d regions, %d extents",
+      name, map->len, dump->len);
+
+  g_free(tmp);
+  g_free(name);
+  g_free(description);
+  g_free(records);
+  g_array_free(dump, TRUE);
+  g_array_free(map, TRUE);
+  return code == 0 ? 0 : -EIO;
+}
+
+void SaveSessionRequest()
+{
+  save_requested = 1;
+}
+
+int SaveSessionPending(struct NaClApp *nap)
+{
+  if(save_requested) return 1;
+  if(nap->manifest->checkpoint <= 0) return 0;
+
+  /* the 1st interval is counted from the 1st trap */
+  if(next_checkpoint == 0) ScheduleCheckpoint(nap->manifest);
+  return g_get_monotonic_time() >= next_checkpoint;
+}
+
+int SessionImageMapped()
+{
+  return mapped;
+}
+
+void SessionForget()
+{
+  save_requested = 0;
+  next_checkpoint = 0;
+  base_id = 0;
+  generation = 0;
+  tracking = 0;
+}
+
+/* check the image records up. the image is not trusted */
+static void CheckImage(struct NaClApp *nap)
+{
+  struct stat st;
+  int i;
+
+  ZLOGFAIL(fstat(image, &st) != 0, errno, "cannot stat session image");
+
+#define LIMIT(a, b) ZLOGFAIL((a) > (b), ENOEXEC, "invalid session image: %s", #a)
+  LIMIT(header.data_end, FOURGIG - header.stack_size);
+  LIMIT(header.static_text_end, header.data_end);
+  LIMIT(header.initial_entry_pt, header.static_text_end);
+  LIMIT(NACL_TRAMPOLINE_END, header.static_text_end);
+  LIMIT(header.static_text_end % NACL_MAP_PAGESIZE, 0);
+  LIMIT(header.rodata_start, header.data_end);
+  LIMIT(header.data_start, header.data_end);
+  LIMIT(header.break_addr, header.data_end);
+  LIMIT(header.dynamic_text_start, header.static_text_end);
+  LIMIT(header.dynamic_text_end, header.dynamic_text_start);
+  LIMIT(header.stack_size, nap->stack_size);
+  LIMIT(nap->stack_size, header.stack_size);
+
+  for(i = 0; i < header.regions; ++i)
+  {
+    LIMIT(NACL_TRAMPOLINE_END, regions[i].start);
+    LIMIT(regions[i].start, FOURGIG);
+    LIMIT(regions[i].size, FOURGIG - regions[i].start);
+    LIMIT((regions[i].start | regions[i].size) % NACL_PAGESIZE, 0);
+    LIMIT(regions[i].prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC), 0);
+    LIMIT((regions[i].prot & (PROT_WRITE | PROT_EXEC)) == (PROT_WRITE | PROT_EXEC), 0);
+  }
+
+  for(i = 0; i < header.extents; ++i)
+  {
+    LIMIT(NACL_TRAMPOLINE_END, extents[i].start);
+    LIMIT(extents[i].start, FOURGIG);
+    LIMIT(extents[i].size, FOURGIG - extents[i].start);
+    LIMIT((extents[i].start | extents[i].size | extents[i].offset)
+        % NACL_PAGESIZE, 0);
+    if(extents[i].offset != ZERO_PAGES)
+    {
+      LIMIT(extents[i].offset, (uint64_t)st.st_size);
+      LIMIT(extents[i].size, st.st_size - extents[i].offset);
+    }
+  }
+
+  /* the positions and the counters must fit the manifest limits */
+  LIMIT(header.positions, nap->manifest->channels->len);
+  for(i = 0; i < header.positions; ++i)
+  {
+    struct ChannelDesc *channel = CH_CH(nap->manifest, i);
+    int k;
+
+    LIMIT(0, positions[i].getpos);
+    if(CH_SEQ_READABLE(channel))
+      LIMIT(positions[i].getpos, channel->limits[GetSizeLimit]);
+    for(k = 0; k < LimitsNumber; ++k)
+    {
+      LIMIT(0, positions[i].counters[k]);
+      LIMIT(positions[i].counters[k], channel->limits[k]);
+    }
+  }
+#undef LIMIT
+}
+
+static void FreeRecords()
+{
+  g_free(regions);
+  g_free(extents);
+  g_free(positions);
+  g_free(channels);
+  regions = NULL;
+  extents = NULL;
+  positions = NULL;
+  channels = NULL;
+}
+
+/* read the header and the records of the image */
+static void ReadRecords(struct NaClApp *nap)
+{
+  off_t offset;
+
+  FreeRecords();
+  ZLOGFAIL(ReadImage(&header, sizeof header, 0) != 0, EIO,
+      "cannot read session header");
+  ZLOGFAIL(header.regions > FOURGIG / NACL_PAGESIZE
+      || header.extents > FOURGIG / NACL_PAGESIZE
+      || header.positions > CHANNELS_LIMIT
+      || header.channels > CHANNELS_LIMIT, ENOEXEC,
+      "invalid session image: records number");
+
+  regions = g_malloc(header.regions * sizeof *regions);
+  extents = g_malloc(header.extents * sizeof *extents);
+  positions = g_malloc(header.positions * sizeof *positions);
+  channels = g_malloc0(header.channels + 1);
+  offset = sizeof header;
+  ZLOGFAIL(ReadImage(regions, header.regions * sizeof *regions, offset) != 0,
+      EIO, "cannot read session memory map");
+  offset += header.regions * sizeof *regions;
+  ZLOGFAIL(ReadImage(extents, header.extents * sizeof *extents, offset) != 0,
+      EIO, "cannot read session memory dump records");
+  offset += header.extents * sizeof *extents;
+  ZLOGFAIL(ReadImage(positions, header.positions * sizeof *positions,
+      offset) != 0, EIO, "cannot read session channels positions");
+  offset += header.positions * sizeof *positions;
+  ZLOGFAIL(ReadImage(channels, header.channels, offset) != 0,
+      EIO, "cannot read session channels");
+  CheckImage(nap);
 }
 
 int LoadSession(struct NaClApp *nap, const char *name)
 {
-  void *map;
+  assert(nap != NULL);
   if(IsImage(name) < 0) return -1;
 
-  map = LoadMemoryMap(nap);
-  LoadMemory1(nap, map);
-  LoadMemory2(nap, map);
-  LoadUserContext(nap);
-  CheckManifest(nap);
+  /* read header, memory map, memory dump records and channels */
+  ReadRecords(nap);
+  ZLOGFAIL(header.generation != 0, ENOEXEC,
+      "%s is not the base session image", name);
+  session = g_strdup(name);
+
+  /* restore the layout and allocate the user space */
+  nap->static_text_end = header.static_text_end;
+  nap->dynamic_text_start = header.dynamic_text_start;
+  nap->dynamic_text_end = header.dynamic_text_end;
+  nap->rodata_start = header.rodata_start;
+  nap->data_start = header.data_start;
+  nap->data_end = header.data_end;
+  nap->break_addr = header.break_addr;
+  nap->initial_entry_pt = header.initial_entry_pt;
+  AppLoadImage(nap, -1, 0);
+
+  return 0;
+}
+
+/*
+ * open the delta "n" of the restored session and read its records
+ * 0: success, -1: no more deltas (missing, or left from the other base)
+ */
+static int OpenDelta(struct NaClApp *nap, uint64_t n)
+{
+  struct Header hdr;
+  char *name;
+  int code;
+
+  /* the layout must be the same as the base one */
+#define LAYOUT(h) &(h).static_text_end
+#define LAYOUT_SIZE (offsetof(struct Header, context) \
+    - offsetof(struct Header, static_text_end))
+
+  close(image);
+  image = -1;
+  name = g_strdup_printf("%s.%lu", session, n);
+  code = IsImage(name);
+  g_free(name);
+  if(code != 0) return -1;
 
+  ZLOGFAIL(ReadImage(&hdr, sizeof hdr, 0) != 0, EIO,
+      "cannot read session delta header");
+  if(hdr.base != header.base || hdr.generation != n) return -1;
+  ZLOGFAIL(memcmp(LAYOUT(hdr), LAYOUT(header), LAYOUT_SIZE) != 0,
+      ENOEXEC, "invalid session delta: layout");
+  ReadRecords(nap);
+
+#undef LAYOUT_SIZE
+#undef LAYOUT
   return 0;
 }
+
+/* read old manifest from image, and check it up against the new one */
+static void CheckManifest(struct NaClApp *nap)
+{
+  char *description = ChannelsDescription(nap->manifest);
+
+  ZLOGFAIL(header.mem_size != nap->manifest->mem_size
+      || header.heap_end != nap->heap_end, EFAULT,
+      "the session memory differs from the saved one");
+  ZLOGFAIL(g_strcmp0(description, channels) != 0
+      || header.positions != nap->manifest->channels->len, EFAULT,
+      "the session channels differ from the saved ones");
+  g_free(description);
+}
+
+/*
+ * return 1 if only zerovm user (or root) can change the image. the pages
+ * of private mapping follow the file changes until they are copied
+ */
+static int IsPrivateImage()
+{
+  struct stat st;
+
+  if(fstat(image, &st) != 0) return 0;
+  return (st.st_mode & (S_IWGRP | S_IWOTH)) == 0
+      && (st.st_uid == getuid() || st.st_uid == 0);
+}
+
+/*
+ * load memory dump from image to user space. the private image is mapped
+ * copy-on-write, so only the pages touched by the session are read. the
+ * zero pages of the delta replace the older content
+ */
+static void LoadMemory(struct NaClApp *nap)
+{
+  int lazy = IsPrivateImage();
+  int i;
+
+  ZLOGS(LOG_DEBUG, "%s session memory restoring, image %lu",
+      lazy ? "lazy" : "eager", header.generation);
+  for(i = 0; i < header.extents; ++i)
+  {
+    void *addr = (void*)(nap->mem_start + extents[i].start);
+
+    if(extents[i].offset == ZERO_PAGES)
+    {
+      ZLOGFAIL(mmap(addr, extents[i].size, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != addr,
+          errno, "cannot restore session zero pages");
+      continue;
+    }
+
+    if(lazy)
+    {
+      ZLOGFAIL(mmap(addr, extents[i].size, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_FIXED, image, extents[i].offset) != addr,
+          errno, "cannot map session memory");
+      mapped = 1;
+      continue;
+    }
+
+    ZLOGFAIL(NaCl_mprotect(addr, extents[i].size, PROT_READ | PROT_WRITE) != 0,
+        EFAULT, "cannot restore session memory");
+    ZLOGFAIL(ReadImage(addr, extents[i].size, extents[i].offset) != 0,
+        EIO, "cannot read session memory");
+  }
+}
+
+/* move "size" bytes at "addr" from the image mapping to the anonymous one */
+static void CopyMemory(void *addr, size_t size)
+{
+  void *copy = g_malloc(size);
+
+  memcpy(copy, addr, size);
+  ZLOGFAIL(mmap(addr, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != addr,
+      errno, "cannot copy session executable memory");
+  memcpy(addr, copy, size);
+  g_free(copy);
+}
+
+/*
+ * validate executable memory out of the static text (the static text is
+ * validated as usual) and restore the memory protection. the executable
+ * memory is never backed by the image: it is validated once and the image
+ * can be on "noexec" file system
+ */
+static void LoadMemoryMap(struct NaClApp *nap)
+{
+  int i;
+
+  for(i = 0; i < header.regions; ++i)
+  {
+    uintptr_t start = MAX(regions[i].start, nap->static_text_end);
+    uintptr_t end = regions[i].start + regions[i].size;
+    void *addr = (void*)(nap->mem_start + regions[i].start);
+
+    if((regions[i].prot & PROT_EXEC) != 0)
+    {
+      ZLOGFAIL(NaCl_mprotect(addr, regions[i].size, PROT_READ | PROT_WRITE)
+          != 0, EFAULT, "cannot restore session executable memory");
+      if(mapped) CopyMemory(addr, regions[i].size);
+      if(start < end)
+        ZLOGFAIL(!NaClSegmentValidates((uint8_t*)nap->mem_start + start,
+            end - start, nap->mem_start + start), ENOEXEC,
+            "session executable memory validation failed");
+    }
+
+    ZLOGFAIL(NaCl_mprotect(addr, regions[i].size, regions[i].prot) != 0,
+        EFAULT, "cannot restore session memory protection");
+  }
+}
+
+/*
+ * restore the channels counters and the read positions. the sequential
+ * input continues from the saved position (the pipes and the network are
+ * skipped up to it). the output positions are set by the channels
+ * construction as usual
+ */
+static void RestoreChannels(struct NaClApp *nap)
+{
+  int i;
+
+  for(i = 0; i < nap->manifest->channels->len; ++i)
+  {
+    struct ChannelDesc *channel = CH_CH(nap->manifest, i);
+
+    memcpy(channel->counters, positions[i].counters, sizeof channel->counters);
+    if(!IS_WO(channel)) channel->getpos = positions[i].getpos;
+  }
+}
+
+void RestoreSession(struct NaClApp *nap)
+{
+  uint64_t n;
+
+  assert(nap != NULL);
+  assert(image >= 0);
+
+  /* the prefault helper must not touch the memory being restored */
+  PrefaultWait();
+  LoadMemory(nap);
+  for(n = 1; OpenDelta(nap, n) == 0; ++n)
+    LoadMemory(nap);
+
+  /* the last image holds the actual memory map, context and channels */
+  CheckManifest(nap);
+  LoadMemoryMap(nap);
+  RestoreChannels(nap);
+  ZLOGS(LOG_DEBUG, "session restored from %s and %lu deltas", session, n - 1);
+
+  if(image >= 0) close(image);
+  image = -1;
+  FreeRecords();
+  g_free(session);
+  session = NULL;
+}
+
+NORETURN void ResumeSession(struct NaClApp *nap)
+{
+  struct ThreadContext *context = &header.context;
+
+  assert(nap != NULL);
+
+  /* the sandbox registers are rebased to the new user space */
+  ThreadContextCtor(nacl_sys, nap, 1, GetStackPtr());
+  *nacl_user = *context;
+  nacl_user->r15 = nap->mem_start;
+  nacl_user->rsp = nap->mem_start + (uint32_t)context->rsp;
+  nacl_user->rbp = nap->mem_start + (uint32_t)context->rbp;
+  nacl_user->prog_ctr = NaClSandboxCodeAddr(nap, context->prog_ctr);
+
+  /* pass control to the user side */
+  ZLOGS(LOG_DEBUG, "SESSION %d RESTORED", nap->manifest->node);
+  ContextSwitch(nacl_user);
+  ZLOGFAIL(1, EFAULT, "the unreachable has been reached");
+}
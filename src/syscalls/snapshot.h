@@ -19,10 +19,40 @@
 #ifndef SNAPSHOT_H_
 #define SNAPSHOT_H_
 
-/* load session from given image. 0: success, -1: failed */
+/*
+ * prepare the user space for the session image "name": restore the
+ * layout, allocate the user space and install the trampoline
+ * 0: success, -1: "name" is not a session image
+ */
 int LoadSession(struct NaClApp *nap, const char *name);
 
-/* store session to image "Save". 0: success, -1: failed */
-int SaveSession(struct NaClApp *nap);
+/*
+ * restore the user memory of the loaded session image. the channels must
+ * be constructed and match the saved ones. the static text should be
+ * validated as usual after the call
+ */
+void RestoreSession(struct NaClApp *nap);
+
+/* pass control to the restored session (return from the saving trap) */
+NORETURN void ResumeSession(struct NaClApp *nap);
+
+/*
+ * store the session (called from the trap) to image "Save". incremental
+ * saving writes the delta of the last image (if possible)
+ * 0: success, -errno: failed
+ */
+int SaveSession(struct NaClApp *nap, int incremental);
+
+/* ask to save the session upon the next trap (async-signal-safe) */
+void SaveSessionRequest();
+
+/* return not 0 if the checkpoint was asked or "Checkpoint" interval passed */
+int SaveSessionPending(struct NaClApp *nap);
+
+/* return not 0 if the user memory can be backed by the session image */
+int SessionImageMapped();
+
+/* forget the saved images and the checkpoints schedule (recycling) */
+void SessionForget();
 
 #endif /* SNAPSHOT_H_ */
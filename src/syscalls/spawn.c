@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <assert.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include "src/main/report.h"
+#include "src/main/setup.h"
+#include "src/channels/channel.h"
+#include "src/syscalls/spawn.h"
+
+/* exit record of the spawned session. lives in the shared memory */
+struct SpawnResult {
+  int32_t code;
+  int32_t done; /* the session called exit */
+};
+
+static struct SpawnResult *results = NULL;
+static pid_t pids[MAX_SPAWNED];
+static int spawned = 0; /* number of not waited children */
+static int self = 0; /* 0 - parent, otherwise index of the spawned session */
+
+#define RESULTS_SIZE (MAX_SPAWNED * sizeof *results)
+
+/* parent: kill and wait spawned sessions, release the results */
+static void SpawnCleanup()
+{
+  int i;
+
+  for(i = 0; i < spawned; ++i)
+  {
+    kill(pids[i], SIGKILL);
+    waitpid(pids[i], NULL, 0);
+  }
+  munmap(results, RESULTS_SIZE);
+  results = NULL;
+  spawned = 0;
+}
+
+int32_t Spawn(struct NaClApp *nap, int32_t count)
+{
+  pid_t parent = getpid();
+  unsigned left;
+  int i;
+
+  assert(nap != NULL);
+
+  /* nested spawn is not supported, previous children must be waited */
+  if(self != 0) return -EPERM;
+  if(spawned != 0) return -EBUSY;
+  if(count < 1 || count > MAX_SPAWNED) return -EINVAL;
+
+  results = mmap(NULL, RESULTS_SIZE, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(results == MAP_FAILED)
+  {
+    results = NULL;
+    return -ENOMEM;
+  }
+
+  /* children should not repeat buffered output and must keep the timeout */
+  fflush(NULL);
+  left = alarm(0);
+  alarm(left);
+
+  for(i = 0; i < count; ++i)
+  {
+    pids[i] = fork();
+    if(pids[i] < 0)
+    {
+      int code = errno;
+      SpawnCleanup();
+      return -code;
+    }
+    ++spawned;
+
+    /* child: detach from the parent channels and continue the session */
+    if(pids[i] == 0)
+    {
+      /* the session must not outlive the parent */
+      prctl(PR_SET_PDEATHSIG, SIGKILL);
+      if(getppid() != parent) _exit(1);
+
+      self = i + 1;
+      spawned = 0;
+      alarm(left);
+      ReportMode(1);
+      ChannelsDetach(nap->manifest, self);
+      SetChannelsState(nap);
+      ZLOGS(LOG_DEBUG, "session %d spawned", self);
+      return self;
+    }
+  }
+
+  ZLOGS(LOG_DEBUG, "%d sessions spawned", count);
+  return 0;
+}
+
+int32_t SpawnWait(int32_t *codes, int32_t count)
+{
+  int i;
+  int status;
+  int32_t failed = 0;
+
+  if(spawned == 0) return -ECHILD;
+  if(count != spawned) return -EINVAL;
+
+  for(i = 0; i < spawned; ++i)
+  {
+    ZLOGFAIL(waitpid(pids[i], &status, 0) < 0, errno, "cannot wait session");
+    if(results[i].done && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+      codes[i] = results[i].code;
+    else
+    {
+      codes[i] = -1;
+      ++failed;
+    }
+  }
+
+  munmap(results, RESULTS_SIZE);
+  results = NULL;
+  spawned = 0;
+  return failed;
+}
+
+void SpawnExit(struct NaClApp *nap, int32_t code)
+{
+  if(self == 0) return;
+
+  results[self - 1].code = code;
+  results[self - 1].done = 1;
+  ChannelsDtor(nap->manifest);
+  ZLOGS(LOG_DEBUG, "spawned session %d returned %d", self, code);
+  _exit(0);
+}
+
+void SpawnDtor()
+{
+  if(spawned != 0) SpawnCleanup();
+}
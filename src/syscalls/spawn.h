@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SPAWN_H_
+#define SPAWN_H_
+
+#include "src/loader/sel_ldr.h"
+
+/* maximum number of the spawned sessions */
+#define MAX_SPAWNED 0x100
+
+/*
+ * fork "count" child sessions sharing the user memory copy-on-write.
+ * return 0 to the parent, child index (1..count) to the children or
+ * -errno if failed
+ */
+int32_t Spawn(struct NaClApp *nap, int32_t count);
+
+/*
+ * parent: wait for all spawned sessions and put their exit codes to
+ * "codes" (-1 for the failed sessions). return number of failed sessions
+ * or -errno
+ */
+int32_t SpawnWait(int32_t *codes, int32_t count);
+
+/*
+ * child: store the user exit code, close channels and finish the session.
+ * returns only if called from the parent session
+ */
+void SpawnExit(struct NaClApp *nap, int32_t code);
+
+/* parent: kill not waited spawned sessions (recycling or the session end) */
+void SpawnDtor();
+
+#endif /* SPAWN_H_ */
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <assert.h>
+#include <pthread.h>
+#include "src/platform/signal.h"
+#include "src/syscalls/switch_to_app.h"
+#include "src/syscalls/thread.h"
+
+enum ThreadState {
+  ThreadFree,
+  ThreadRunning,
+  ThreadFinished
+};
+
+struct Thread {
+  pthread_t handle;
+  struct ThreadContext user; /* user registers storage */
+  struct ThreadContext sys; /* zerovm registers storage */
+  void *signal_stack;
+  enum ThreadState state;
+  int32_t code; /* user exit code */
+};
+
+static struct Thread threads[MAX_THREADS];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER;
+static __thread struct Thread *self = NULL; /* NULL for the main thread */
+
+/* zerovm side of the user thread. pass control to the user code */
+static void *ThreadMain(void *arg)
+{
+  self = arg;
+  self->signal_stack = SignalThreadCtor();
+
+  /* each thread has own registers storage */
+  nacl_user = &self->user;
+  nacl_sys = &self->sys;
+  ThreadContextCtor(nacl_sys, gnap, 1, GetStackPtr());
+
+  ContextSwitch(nacl_user);
+  ZLOGFAIL(1, EFAULT, "the unreachable has been reached");
+  return NULL;
+}
+
+int32_t ThreadCreate(struct NaClApp *nap,
+    uintptr_t entry, uint32_t arg, uintptr_t stack, int32_t size)
+{
+  int i;
+  int result;
+  uintptr_t stack_ptr;
+  pthread_attr_t attr;
+  struct Thread *t = NULL;
+
+  assert(nap != NULL);
+
+  /* reserve the thread record */
+  pthread_mutex_lock(&lock);
+  for(i = 0; i < MAX_THREADS && t == NULL; ++i)
+    if(threads[i].state == ThreadFree) t = &threads[i];
+  if(t != NULL) t->state = ThreadRunning;
+  pthread_mutex_unlock(&lock);
+  if(t == NULL) return -EAGAIN;
+
+  /* set user stack (16 bytes aligned) with the dummy return address */
+  stack_ptr = NaClUserToSys(nap, ((stack + size) & ~0xfLLU) - sizeof(uint64_t));
+  *(uint64_t*)stack_ptr = 0;
+  ThreadContextCtor(&t->user, nap, entry, stack_ptr);
+  t->user.rdi = arg;
+
+  /* start zerovm side of the thread */
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+  result = pthread_create(&t->handle, &attr, ThreadMain, t);
+  pthread_attr_destroy(&attr);
+
+  if(result != 0)
+  {
+    pthread_mutex_lock(&lock);
+    t->state = ThreadFree;
+    pthread_mutex_unlock(&lock);
+    return -result;
+  }
+
+  /* thread id is 1-based index of the record */
+  ZLOGS(LOG_DEBUG, "thread %d started", t - threads + 1);
+  return t - threads + 1;
+}
+
+int32_t ThreadJoin(int32_t id)
+{
+  int32_t code;
+  struct Thread *t;
+
+  if(id < 1 || id > MAX_THREADS) return -EINVAL;
+  t = &threads[id - 1];
+  if(t == self) return -EDEADLK;
+
+  /* wait for the thread end */
+  pthread_mutex_lock(&lock);
+  while(t->state == ThreadRunning)
+    pthread_cond_wait(&finished, &lock);
+
+  /* thread is not started or already joined */
+  if(t->state != ThreadFinished)
+  {
+    pthread_mutex_unlock(&lock);
+    return -ESRCH;
+  }
+
+  /* release the thread record */
+  code = t->code;
+  pthread_join(t->handle, NULL);
+  t->state = ThreadFree;
+  pthread_mutex_unlock(&lock);
+
+  ZLOGS(LOG_DEBUG, "thread %d joined with %d", id, code);
+  return code;
+}
+
+void ThreadExit(int32_t code)
+{
+  if(self == NULL) return;
+
+  SignalThreadDtor(self->signal_stack);
+  pthread_mutex_lock(&lock);
+  self->code = code;
+  self->state = ThreadFinished;
+  pthread_cond_broadcast(&finished);
+  pthread_mutex_unlock(&lock);
+
+  pthread_exit(NULL);
+}
+
+int ThreadsCount()
+{
+  int i;
+  int count = 0;
+
+  pthread_mutex_lock(&lock);
+  for(i = 0; i < MAX_THREADS; ++i)
+    count += threads[i].state != ThreadFree;
+  pthread_mutex_unlock(&lock);
+
+  return count;
+}
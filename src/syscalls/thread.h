@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2012, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef THREAD_H_
+#define THREAD_H_
+
+#include "src/loader/sel_ldr.h"
+
+/* maximum number of user threads (except the main one) */
+#define MAX_THREADS 0x100
+
+/* zerovm (trusted) stack size of user thread */
+#define THREAD_STACK_SIZE 0x100000
+
+/*
+ * start the user thread from "entry" with "arg" in %rdi using user
+ * allocated stack "stack" of "size" bytes. return the thread id or -errno
+ */
+int32_t ThreadCreate(struct NaClApp *nap,
+    uintptr_t entry, uint32_t arg, uintptr_t stack, int32_t size);
+
+/* wait for the user thread "id" end. return its exit code or -errno */
+int32_t ThreadJoin(int32_t id);
+
+/*
+ * finish the calling user thread with "code". the function only returns
+ * if called from the main thread
+ */
+void ThreadExit(int32_t code);
+
+/* return the number of not joined user threads */
+int ThreadsCount();
+
+#endif /* THREAD_H_ */
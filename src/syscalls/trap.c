@@ -14,16 +14,30 @@
  * limitations under the License.
  */
 #include <assert.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include "src/channels/channel.h"
 #include "src/main/report.h"
 #include "src/platform/sel_memory.h"
 #include "src/main/setup.h"
 #include "src/syscalls/daemon.h"
+#include "src/syscalls/thread.h"
+#include "src/syscalls/spawn.h"
+#include "src/syscalls/snapshot.h"
 
-static int idx[] = {TrapRead, TrapWrite, TrapJail, TrapUnjail, TrapExit, TrapFork};
-static char *function[] =
-  {"TrapRead", "TrapWrite", "TrapJail", "TrapUnjail", "TrapExit", "TrapFork", "n/a"};
+/* the smallest user thread stack */
+#define MIN_USER_STACK 0x1000
+
+static int idx[] = {TrapRead, TrapWrite, TrapJail, TrapUnjail,
+  TrapExit, TrapFork, TrapPoll, TrapRead64, TrapWrite64, TrapRelease,
+  TrapThread, TrapJoin, TrapSpawn, TrapWait, TrapSave};
+static char *function[] = {"TrapRead", "TrapWrite", "TrapJail", "TrapUnjail",
+  "TrapExit", "TrapFork", "TrapPoll", "TrapRead64", "TrapWrite64",
+  "TrapRelease", "TrapThread", "TrapJoin", "TrapSpawn", "TrapWait",
+  "TrapSave", "n/a"};
+
+/* serializes ztrace and report between user threads */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /*
  * check "prot" access for user area (start, size)
@@ -51,32 +65,13 @@ static int CheckRAMAccess(struct NaClApp *nap, uintptr_t start, int64_t size, in
   return -1;
 }
 
-/*
- * read specified amount of bytes from given desc/offset to buffer
- * return amount of read bytes or negative error code if call failed
- */
-static int32_t ZVMReadHandle(struct NaClApp *nap,
-    int ch, char *buffer, int32_t size, int64_t offset)
+/* read from the locked channel. see ZVMReadHandle() */
+static int64_t LockedRead(struct NaClApp *nap,
+    struct ChannelDesc *channel, char *buffer, int64_t size, int64_t offset)
 {
-  struct ChannelDesc *channel;
   int64_t tail;
   char *sys_buffer;
 
-  assert(nap != NULL);
-  assert(nap->manifest != NULL);
-  assert(nap->manifest->channels != NULL);
-
-  /* check the channel number */
-  if(ch < 0 || ch >= nap->manifest->channels->len)
-  {
-    ZLOGS(LOG_DEBUG, "channel_id=%d, buffer=%p, size=%d, offset=%ld",
-        ch, buffer, size, offset);
-    return -EINVAL;
-  }
-  channel = CH_CH(nap->manifest, ch);
-  ZLOGS(LOG_INSANE, "channel %s, buffer=%p, size=%d, offset=%ld",
-      channel->alias, buffer, size, offset);
-
   /* check buffer and convert address */
   if(CheckRAMAccess(nap, (uintptr_t)buffer, size, PROT_WRITE) == -1) return -EINVAL;
   sys_buffer = (char*)NaClUserToSys(nap, (uintptr_t)buffer);
@@ -113,15 +108,15 @@ static int32_t ZVMReadHandle(struct NaClApp *nap,
 }
 
 /*
- * write specified amount of bytes from buffer to given desc/offset
+ * read specified amount of bytes from given desc/offset to buffer
  * return amount of read bytes or negative error code if call failed
+ * note: serves both 32-bit and 64-bit traps
  */
-static int32_t ZVMWriteHandle(struct NaClApp *nap,
-    int ch, const char *buffer, int32_t size, int64_t offset)
+static int64_t ZVMReadHandle(struct NaClApp *nap,
+    int ch, char *buffer, int64_t size, int64_t offset)
 {
   struct ChannelDesc *channel;
-  int64_t tail;
-  const char *sys_buffer;
+  int64_t result;
 
   assert(nap != NULL);
   assert(nap->manifest != NULL);
@@ -130,14 +125,28 @@ static int32_t ZVMWriteHandle(struct NaClApp *nap,
   /* check the channel number */
   if(ch < 0 || ch >= nap->manifest->channels->len)
   {
-    ZLOGS(LOG_DEBUG, "channel_id=%d, buffer=%p, size=%d, offset=%ld",
+    ZLOGS(LOG_DEBUG, "channel_id=%d, buffer=%p, size=%ld, offset=%ld",
         ch, buffer, size, offset);
     return -EINVAL;
   }
   channel = CH_CH(nap->manifest, ch);
-  ZLOGS(LOG_INSANE, "channel %s, buffer=%p, size=%d, offset=%ld",
+  ZLOGS(LOG_INSANE, "channel %s, buffer=%p, size=%ld, offset=%ld",
       channel->alias, buffer, size, offset);
 
+  /* the channel checks and i/o must be atomic for user threads */
+  pthread_mutex_lock(&channel->lock);
+  result = LockedRead(nap, channel, buffer, size, offset);
+  pthread_mutex_unlock(&channel->lock);
+  return result;
+}
+
+/* write to the locked channel. see ZVMWriteHandle() */
+static int64_t LockedWrite(struct NaClApp *nap, struct ChannelDesc *channel,
+    const char *buffer, int64_t size, int64_t offset)
+{
+  int64_t tail;
+  const char *sys_buffer;
+
   /* check buffer and convert address */
   if(CheckRAMAccess(nap, (uintptr_t)buffer, size, PROT_READ) == -1) return -EINVAL;
   sys_buffer = (char*)NaClUserToSys(nap, (uintptr_t) buffer);
@@ -165,6 +174,96 @@ static int32_t ZVMWriteHandle(struct NaClApp *nap,
   return ChannelWrite(channel, sys_buffer, (size_t)size, (off_t)offset);
 }
 
+/*
+ * write specified amount of bytes from buffer to given desc/offset
+ * return amount of read bytes or negative error code if call failed
+ * note: serves both 32-bit and 64-bit traps
+ */
+static int64_t ZVMWriteHandle(struct NaClApp *nap,
+    int ch, const char *buffer, int64_t size, int64_t offset)
+{
+  struct ChannelDesc *channel;
+  int64_t result;
+
+  assert(nap != NULL);
+  assert(nap->manifest != NULL);
+  assert(nap->manifest->channels != NULL);
+
+  /* check the channel number */
+  if(ch < 0 || ch >= nap->manifest->channels->len)
+  {
+    ZLOGS(LOG_DEBUG, "channel_id=%d, buffer=%p, size=%ld, offset=%ld",
+        ch, buffer, size, offset);
+    return -EINVAL;
+  }
+  channel = CH_CH(nap->manifest, ch);
+  ZLOGS(LOG_INSANE, "channel %s, buffer=%p, size=%ld, offset=%ld",
+      channel->alias, buffer, size, offset);
+
+  /* the channel checks and i/o must be atomic for user threads */
+  pthread_mutex_lock(&channel->lock);
+  result = LockedWrite(nap, channel, buffer, size, offset);
+  pthread_mutex_unlock(&channel->lock);
+  return result;
+}
+
+/*
+ * wait until any of "count" channels listed in "set" has data or eof
+ * pending. numbers of not ready channels will be replaced with -1
+ * return number of ready channels or negative error code if call failed
+ */
+static int32_t ZVMPollHandle(struct NaClApp *nap,
+    uintptr_t set, int32_t count, int32_t timeout)
+{
+  struct ChannelDesc **channels;
+  int8_t *ready;
+  int32_t *user_set;
+  int32_t *sys_set;
+  int32_t result;
+  int i;
+
+  assert(nap != NULL);
+  assert(nap->manifest != NULL);
+  assert(nap->manifest->channels != NULL);
+
+  /* check arguments sanity */
+  if(count < 1 || count > nap->manifest->channels->len) return -EINVAL;
+  if(timeout < -1) return -EINVAL;
+  if(CheckRAMAccess(nap, set, count * sizeof *sys_set, PROT_WRITE) == -1)
+    return -EINVAL;
+  user_set = (int32_t*)NaClUserToSys(nap, set);
+
+  /* the set is read once: other user threads can change it */
+  sys_set = g_malloc(count * sizeof *sys_set);
+  memcpy(sys_set, user_set, count * sizeof *sys_set);
+
+  /* only readable channels can be polled */
+  for(i = 0; i < count; ++i)
+    if(sys_set[i] < 0 || sys_set[i] >= nap->manifest->channels->len
+        || (CH_RW_TYPE(CH_CH(nap->manifest, sys_set[i])) & 1) == 0)
+    {
+      g_free(sys_set);
+      return -EINVAL;
+    }
+
+  /* poll the channels */
+  channels = g_malloc(count * sizeof *channels);
+  ready = g_malloc0(count * sizeof *ready);
+  for(i = 0; i < count; ++i)
+    channels[i] = CH_CH(nap->manifest, sys_set[i]);
+  result = ChannelsPoll(channels, ready, count, timeout);
+
+  /* hide not ready channels */
+  if(result >= 0)
+    for(i = 0; i < count; ++i)
+      user_set[i] = ready[i] ? sys_set[i] : -1;
+
+  g_free(channels);
+  g_free(ready);
+  g_free(sys_set);
+  return result;
+}
+
 #define JAIL_CHECK \
     uintptr_t sysaddr; \
     int result; \
@@ -188,9 +287,17 @@ static int32_t ZVMJailHandle(struct NaClApp *nap, uintptr_t addr, int32_t size)
 {
   JAIL_CHECK;
 
+  /* freeze the buffer first, other user threads can change it */
+  result = NaCl_mprotect((void*)sysaddr, size, PROT_READ);
+  if(result != 0) return -EACCES;
+
   /* validate */
   result = NaClSegmentValidates((uint8_t*)sysaddr, size, sysaddr);
-  if(result == 0) return -EPERM;
+  if(result == 0)
+  {
+    NaCl_mprotect((void*)sysaddr, size, PROT_READ | PROT_WRITE);
+    return -EPERM;
+  }
 
   /* protect */
   result = NaCl_mprotect((void*)sysaddr, size, PROT_READ | PROT_EXEC);
@@ -210,8 +317,95 @@ static int32_t ZVMUnjailHandle(struct NaClApp *nap, uintptr_t addr, int32_t size
 
   return 0;
 }
+
+/*
+ * give pages of given buffer back to the host. released memory becomes
+ * read / write and filled with zeroes. return 0 if successful
+ */
+static int32_t ZVMReleaseHandle(struct NaClApp *nap, uintptr_t addr, int32_t size)
+{
+  JAIL_CHECK;
+  if(sysaddr + size > nap->mem_map[HeapIdx].end) return -EINVAL;
+
+  /* whole pages only: mprotect and madvise would round the size up */
+  if(size % NACL_MAP_PAGESIZE != 0) return -EINVAL;
+
+  /* jailed code must not survive as zeroes (which are not validated) */
+  result = NaCl_mprotect((void*)sysaddr, size, PROT_READ | PROT_WRITE);
+  if(result != 0) return -EACCES;
+
+  /*
+   * MADV_FREE is not used since it makes the memory content undefined.
+   * the pages mapped from the session image would get the image content
+   * back, so they are replaced with the anonymous ones
+   */
+  if(SessionImageMapped())
+    result = mmap((void*)sysaddr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE
+        | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == (void*)sysaddr ? 0 : -1;
+  else
+    result = NaCl_madvise((void*)sysaddr, size, MADV_DONTNEED);
+  if(result != 0) return -EACCES;
+
+  return 0;
+}
 #undef JAIL_CHECK
 
+/*
+ * start user thread from "entry" with "arg" as the 1st argument using
+ * heap area (stack, size) as the thread stack. return the thread id
+ */
+static int32_t ZVMThreadHandle(struct NaClApp *nap,
+    uintptr_t entry, uint32_t arg, uintptr_t stack, int32_t size)
+{
+  uintptr_t sysaddr;
+
+  assert(nap != NULL);
+
+  /* entry must be a bundle in the executable memory */
+  if(entry % NACL_INSTR_BLOCK_SIZE != 0) return -EINVAL;
+  if(CheckRAMAccess(nap, entry, NACL_INSTR_BLOCK_SIZE, PROT_EXEC) == -1)
+    return -EINVAL;
+
+  /* stack must be a writable part of the heap */
+  sysaddr = NaClUserToSysAddrNullOkay(nap, stack);
+  if(size < MIN_USER_STACK) return -EINVAL;
+  if(sysaddr < nap->mem_map[HeapIdx].start ||
+      sysaddr + size > nap->mem_map[HeapIdx].end) return -EINVAL;
+  if(CheckRAMAccess(nap, stack, size, PROT_WRITE) == -1) return -EINVAL;
+
+  return ThreadCreate(nap, entry, arg, stack, size);
+}
+
+/*
+ * wait for the spawned sessions and put "count" exit codes to "codes"
+ * return number of failed sessions or negative error code
+ */
+static int32_t ZVMWaitHandle(struct NaClApp *nap, uintptr_t codes, int32_t count)
+{
+  assert(nap != NULL);
+
+  if(count < 1 || count > MAX_SPAWNED) return -EINVAL;
+  if(CheckRAMAccess(nap, codes, count * sizeof(int32_t), PROT_WRITE) == -1)
+    return -EINVAL;
+
+  return SpawnWait((int32_t*)NaClUserToSys(nap, codes), count);
+}
+
+/*
+ * save the session image (or the delta if "incremental"). the restored
+ * session gets "result" from the trap. return 0 or negative error code
+ */
+static int32_t ZVMSaveHandle(struct NaClApp *nap,
+    int64_t result, int incremental)
+{
+  assert(nap != NULL);
+
+  /* only the calling thread can be saved */
+  if(ThreadsCount() > 0) return -EBUSY;
+  nacl_user->sysret = result;
+  return SaveSession(nap, incremental);
+}
+
 /* return index of function id in "function" */
 static int FunctionIndexById(int id)
 {
@@ -226,8 +420,12 @@ static void SyscallZTrace(int i, ...)
 {
   char *msg;
   va_list ap;
-  char *fmt[] = {"%s(%d, %p, %d, %ld) = %d", "%s(%d, %p, %d, %ld) = %d",
-      "%s(%p, %d) = %d", "%s(%p, %d) = %d", "%s(%d) = %d", "%s()"};
+  char *fmt[] = {"%s(%d, %p, %d, %ld) = %ld", "%s(%d, %p, %d, %ld) = %ld",
+      "%s(%p, %d) = %ld", "%s(%p, %d) = %ld", "%s(%d) = %ld", "%s()",
+      "%s(%p, %d, %d) = %ld", "%s(%d, %p, %ld, %ld) = %ld",
+      "%s(%d, %p, %ld, %ld) = %ld", "%s(%p, %d) = %ld",
+      "%s(%p, %d, %p, %d) = %ld", "%s(%d) = %ld", "%s(%d) = %ld",
+      "%s(%p, %d) = %ld", "%s()"};
 
   va_start(ap, i);
   msg = g_strdup_vprintf(fmt[i], ap);
@@ -236,23 +434,32 @@ static void SyscallZTrace(int i, ...)
   g_free(msg);
 }
 
-/* user exit. session is finished */
+/*
+ * user exit. the user thread is finished, if called from the main
+ * thread the session (or the spawned session) is finished
+ */
 static void ZVMExitHandle(struct NaClApp *nap, int32_t code)
 {
   assert(nap != NULL);
 
+  pthread_mutex_lock(&trace_lock);
+  SyscallZTrace(4, function[4], code);
+  pthread_mutex_unlock(&trace_lock);
+  ThreadExit(code);
+  SpawnExit(nap, code);
+
   SetUserCode(code);
   if(GetExitCode() == 0)
     SetExitState(OK_STATE);
   ZLOGS(LOG_DEBUG, "SESSION %d RETURNED %d", nap->manifest->node, code);
-  SyscallZTrace(4, function[4], code);
+  RecycleSession(nap);
   ReportDtor(0);
 }
 
-int32_t TrapHandler(struct NaClApp *nap, uint32_t args)
+int64_t TrapHandler(struct NaClApp *nap, uint32_t args)
 {
-  uint64_t *sargs;
-  int retcode = 0;
+  uint64_t sargs[6];
+  int64_t retcode = 0;
   int i;
 
   assert(nap != NULL);
@@ -262,15 +469,21 @@ int32_t TrapHandler(struct NaClApp *nap, uint32_t args)
    * translate address from user space to system
    * note: cannot set "trap error"
    */
-  sargs = (uint64_t*)NaClUserToSys(nap, (uintptr_t)args);
+  /* the arguments are read once: other user threads can change them */
+  memcpy(sargs, (void*)NaClUserToSys(nap, (uintptr_t)args), sizeof sargs);
   i = FunctionIndexById(*sargs);
   ZLOGS(LOG_DEBUG, "%s called", function[i]);
+  pthread_mutex_lock(&trace_lock);
   ZTrace("untrusted code");
+  pthread_mutex_unlock(&trace_lock);
 
   switch(*sargs)
   {
     case TrapFork:
-      if(Daemon(nap) == 0)
+      /* only the main thread survives fork() */
+      if(ThreadsCount() > 0)
+        retcode = -EBUSY;
+      else if(Daemon(nap) == 0)
       {
         SyscallZTrace(5, function[5]);
         ZVMExitHandle(nap, 0);
@@ -287,21 +500,59 @@ int32_t TrapHandler(struct NaClApp *nap, uint32_t args)
       retcode = ZVMWriteHandle(nap,
           (int)sargs[2], (char*)sargs[3], (int32_t)sargs[4], sargs[5]);
       break;
+    case TrapRead64:
+      retcode = ZVMReadHandle(nap,
+          (int)sargs[2], (char*)sargs[3], (int64_t)sargs[4], sargs[5]);
+      break;
+    case TrapWrite64:
+      retcode = ZVMWriteHandle(nap,
+          (int)sargs[2], (char*)sargs[3], (int64_t)sargs[4], sargs[5]);
+      break;
     case TrapJail:
       retcode = ZVMJailHandle(nap, (uint32_t)sargs[2], (int32_t)sargs[3]);
       break;
     case TrapUnjail:
       retcode = ZVMUnjailHandle(nap, (uint32_t)sargs[2], (int32_t)sargs[3]);
       break;
+    case TrapRelease:
+      retcode = ZVMReleaseHandle(nap, (uint32_t)sargs[2], (int32_t)sargs[3]);
+      break;
+    case TrapPoll:
+      retcode = ZVMPollHandle(nap,
+          (uint32_t)sargs[2], (int32_t)sargs[3], (int32_t)sargs[4]);
+      break;
+    case TrapThread:
+      retcode = ZVMThreadHandle(nap, (uint32_t)sargs[2],
+          (uint32_t)sargs[3], (uint32_t)sargs[4], (int32_t)sargs[5]);
+      break;
+    case TrapJoin:
+      retcode = ThreadJoin((int32_t)sargs[2]);
+      break;
+    case TrapSpawn:
+      /* only the calling thread survives fork() */
+      retcode = ThreadsCount() > 0 ? -EBUSY : Spawn(nap, (int32_t)sargs[2]);
+      break;
+    case TrapWait:
+      retcode = ZVMWaitHandle(nap, (uint32_t)sargs[2], (int32_t)sargs[3]);
+      break;
+    case TrapSave:
+      retcode = ZVMSaveHandle(nap, 1, 0);
+      break;
     default:
       retcode = -EPERM;
       ZLOG(LOG_ERROR, "function %ld is not supported", *sargs);
       break;
   }
 
+  /* the checkpoint asked by SIGPWR or "Checkpoint". trap result is restored */
+  if(SaveSessionPending(nap) && ThreadsCount() == 0)
+    ZVMSaveHandle(nap, retcode, 1);
+
   /* report, ztrace and return */
+  pthread_mutex_lock(&trace_lock);
   FastReport();
-  ZLOGS(LOG_DEBUG, "%s returned %d", function[i], retcode);
+  ZLOGS(LOG_DEBUG, "%s returned %ld", function[i], retcode);
   SyscallZTrace(i, function[i], sargs[2], sargs[3], sargs[4], sargs[5], retcode);
+  pthread_mutex_unlock(&trace_lock);
   return retcode;
 }
@@ -0,0 +1,41 @@
+/*
+ * 64-bit reads of the sequential read only channel test. tests statistics
+ * goes to stdout channel. returns the number of failed tests
+ */
+#include "include/zvmlib.h"
+#include "include/ztest.h"
+
+#define SEQRO "/dev/seqro64"
+
+/* TODO: replace it by the right include */
+#define EINVAL 22
+
+int main(int argc, char **argv)
+{
+  char buf[BIG_ENOUGH];
+
+  FPRINTF(STDERR, "TEST 64-BIT READS OF SEQUENTIAL READ ONLY CHANNEL\n");
+
+  /* correct requests */
+  ZTEST(zvm_pread64(OPEN(SEQRO), buf, 0, 0) == 0);
+  ZTEST(zvm_pread64(OPEN(SEQRO), buf, 1, 0) == 1);
+  ZTEST(zvm_pread64(OPEN(SEQRO), buf, 2, 0) == 2);
+
+  /* incorrect requests: size is not truncated to 32 bits */
+  ZTEST(zvm_pread64(OPEN(SEQRO), buf, 0x100000001LL, 0) == -EINVAL);
+  ZTEST(zvm_pread64(OPEN(SEQRO), buf, -1LL, 0) < 0);
+
+  /* incorrect requests: NULL buffer */
+  ZTEST(zvm_pread64(OPEN(SEQRO), NULL, 1, 0) < 0);
+
+  /* incorrect requests: write attempt */
+  ZTEST(zvm_pwrite64(OPEN(SEQRO), buf, 1, 0) < 0);
+
+  /* incorrect requests: exhausted (32 bytes limit, 3 read) */
+  ZTEST(zvm_pread64(OPEN(SEQRO), buf, 30, 0) == 29);
+  ZTEST(zvm_pread64(OPEN(SEQRO), buf, 10, 0) < 0);
+
+  /* count errors and exit with it */
+  ZREPORT;
+  return 0;
+}
@@ -0,0 +1,45 @@
+/*
+ * channels state test. checks that positions, counters and eof available
+ * from the user manifest follow the channels i/o
+ */
+#include "include/zvmlib.h"
+#include "include/ztest.h"
+
+#define STATE "/dev/state"
+#define DATA_SIZE 25 /* size of state.data */
+
+int main(int argc, char **argv)
+{
+  char buf[BIG_ENOUGH];
+  const struct ZVMChannelState *in = &MANIFEST->channels_state[OPEN(STATE)];
+  const struct ZVMChannelState *out = &MANIFEST->channels_state[OPEN(STDOUT)];
+
+  /* initial state */
+  ZTEST(in->getpos == 0);
+  ZTEST(in->eof == 0);
+  ZTEST(in->counters[GetsLimit] == 0);
+  ZTEST(in->counters[GetSizeLimit] == 0);
+
+  /* read part of the channel */
+  ZTEST(READ(STATE, buf, 10) == 10);
+  ZTEST(in->getpos == 10);
+  ZTEST(in->counters[GetsLimit] == 1);
+  ZTEST(in->counters[GetSizeLimit] == 10);
+  ZTEST(in->eof == 0);
+
+  /* read the rest and eof */
+  ZTEST(READ(STATE, buf, BIG_ENOUGH) == DATA_SIZE - 10);
+  ZTEST(READ(STATE, buf, BIG_ENOUGH) == 0);
+  ZTEST(in->getpos == DATA_SIZE);
+  ZTEST(in->counters[GetsLimit] == 2);
+  ZTEST(in->eof != 0);
+
+  /* write to stdout */
+  ZTEST(WRITE(STDOUT, buf, 5) == 5);
+  ZTEST(out->putpos == 5);
+  ZTEST(out->counters[PutsLimit] == 1);
+  ZTEST(out->counters[PutSizeLimit] == 5);
+
+  ZREPORT;
+  return 0;
+}
@@ -0,0 +1,20 @@
+/*
+ * binary command test. the session forked by the daemon copies the input
+ * channel (the request source or the daemon one) to stdout
+ */
+#include "include/zvmlib.h"
+#include "include/ztest.h"
+
+int main()
+{
+  char buf[BIG_ENOUGH];
+  int size;
+
+  UNREFERENCED_VAR(errcount);
+  zvm_fork();
+
+  /* this part will be run in forked session */
+  size = zvm_pread(OPEN("/dev/input"), buf, sizeof buf, 0);
+  if(size > 0) zvm_pwrite(OPEN(STDOUT), buf, size, 0);
+  return 0;
+}
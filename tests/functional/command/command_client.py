@@ -0,0 +1,60 @@
+# sends the binary commands (see doc/daemon.txt) to the daemon and checks
+# the reports of the spawned sessions. exits with the failed case number
+import socket
+import struct
+import sys
+
+MAGIC = b'ZVMCMD01'
+END, NODE, TIMEOUT, JOB, SAVE, SOURCE = range(6)
+
+
+def record(kind, data=b''):
+    return struct.pack('=II', kind, len(data)) + data
+
+
+def source(alias, name):
+    return record(SOURCE, alias + b'\0' + name)
+
+
+def request(data):
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        sock.connect(sys.argv[1])
+        sock.sendall(MAGIC + data)
+        sock.shutdown(socket.SHUT_WR)
+        resp = sock.makefile('rb')
+        size = int(resp.read(8), 0)
+        lines = resp.read(size).decode().split('\n')
+        return lines[5].replace('exit state = ', '')
+    finally:
+        sock.close()
+
+
+def check(case, data, state, output=None, expected=None):
+    result = request(data)
+    if state not in result or output and open(output).read() != expected:
+        sys.stdout.write('case %d: %s\n' % (case, result))
+        sys.exit(case)
+
+pwd = sys.argv[2].encode()
+
+# the omitted channel keeps the daemon source
+check(1, record(NODE, struct.pack('=i', 3))
+      + record(TIMEOUT, struct.pack('=i', 30))
+      + source(b'/dev/stdout', pwd + b'/out1.log') + record(END),
+      'ok', 'out1.log', 'daemon input')
+
+# the request source replaces the daemon one
+check(2, source(b'/dev/stdout', pwd + b'/out2.log')
+      + source(b'/dev/input', pwd + b'/request.data') + record(END),
+      'ok', 'out2.log', 'request input')
+
+# malformed records
+check(3, record(77) + record(END), 'invalid command record 77')
+check(4, struct.pack('=II', SAVE, 0x10001), 'too large command record')
+check(5, record(NODE, b'\0\0') + record(END), 'invalid command record size')
+check(6, record(SOURCE, b'/dev/stdout') + record(END),
+      'invalid source record')
+check(7, source(b'/dev/none', pwd + b'/out3.log') + record(END),
+      'unknown channel /dev/none')
+check(8, record(NODE, struct.pack('=i', 3)), 'cannot read command record')
@@ -0,0 +1,14 @@
+#!/bin/sh
+
+printf "\033[01;38mbinary command\033[00m test has"
+make clean all > /dev/null
+python command_client.py command_test `pwd` > LOG
+result=$?
+if [ "0" != "$result" ]; then
+  echo " \033[01;31mfailed\033[00m on $result"
+  exit $result
+fi
+
+make clean > /dev/null
+echo " \033[01;32mpassed\033[00m"
+exit 0
@@ -0,0 +1,28 @@
+/*
+ * functional test of huge pages backed user memory. the program keeps a
+ * large populated buffer, test.sh checks the coverage achieved in the
+ * report (the huge pages accounting field)
+ */
+#include "include/zvmlib.h"
+#include "include/ztest.h"
+
+#define SIZE (64 * 1024 * 1024)
+
+int main()
+{
+  char *p;
+  int i;
+  int errors = 0;
+
+  /* populate large buffer and check it */
+  p = malloc(SIZE);
+  ZFAIL(p != NULL);
+  memset(p, 0xdb, SIZE);
+  for(i = 0; i < SIZE; ++i)
+    errors += p[i] != (char)0xdb;
+  ZTEST(errors == 0);
+
+  free(p);
+  ZREPORT;
+  return 0;
+}
@@ -0,0 +1,18 @@
+#!/bin/sh
+
+printf "\033[01;38mhuge pages\033[00m test has"
+make clean all>/dev/null
+result=$(grep "FAILED" result.log | awk '{print $4}')
+
+# the 11th accounting field: user memory bytes backed by huge pages
+huge=$(sed -n 5p report.data | sed 's/^accounting = //' | awk '{print $11}')
+thp=/sys/kernel/mm/transparent_hugepage/enabled
+if [ -r $thp ] && ! grep -q "\[never\]" $thp && [ "${huge:-0}" -eq 0 ]; then
+        result="${result:-0} (no huge pages)"
+fi
+if [ "" = "$result" ] && [ -s result.log ]; then
+        echo " \033[01;32mpassed\033[00m"
+        make clean>/dev/null
+else
+        echo " \033[01;31mfailed with $result errors\033[00m"
+fi
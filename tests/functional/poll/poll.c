@@ -0,0 +1,37 @@
+/*
+ * functional test of trap function poll. only local channels are
+ * used, so the test covers the arguments checks and "always ready" cases
+ */
+#include "include/zvmlib.h"
+#include "include/ztest.h"
+
+#define EINVAL 22
+
+int main()
+{
+  int32_t set[2];
+
+  /* local readable channels are always ready */
+  set[0] = handle(STDIN);
+  set[1] = handle("/dev/input");
+  ZTEST(zvm_poll(set, 2, -1) == 2);
+  ZTEST(set[0] == handle(STDIN));
+  ZTEST(set[1] == handle("/dev/input"));
+  set[0] = handle(STDIN);
+  ZTEST(zvm_poll(set, 1, 0) == 1);
+
+  /* write only channel cannot be polled */
+  set[0] = handle(STDOUT);
+  ZTEST(zvm_poll(set, 1, 0) == -EINVAL);
+
+  /* invalid arguments */
+  set[0] = MANIFEST->channels_count;
+  ZTEST(zvm_poll(set, 1, 0) == -EINVAL);
+  set[0] = handle(STDIN);
+  ZTEST(zvm_poll(set, 0, 0) == -EINVAL);
+  ZTEST(zvm_poll(set, 1, -2) == -EINVAL);
+  ZTEST(zvm_poll(NULL, 1, 0) == -EINVAL);
+
+  ZREPORT;
+  return 0;
+}
@@ -0,0 +1,36 @@
+/*
+ * functional test of the user memory population by the helper thread.
+ * the user manifest and the heap must be intact and usable
+ */
+#include "include/zvmlib.h"
+#include "include/ztest.h"
+
+int main()
+{
+  uint32_t size = MANIFEST->heap_size - 16 * PAGESIZE;
+  char *heap;
+  uint32_t i;
+  int dirty = 0;
+  int errors = 0;
+
+  /* the user manifest is built after the population */
+  ZTEST(MANIFEST->channels_count == 3);
+  ZTEST(STRCMP(MANIFEST->channels[0].name, "/dev/stdin") == 0);
+  ZTEST(STRCMP(MANIFEST->channels[2].name, "/dev/stderr") == 0);
+
+  /* almost the whole heap is zeroed and writable */
+  heap = malloc(size);
+  ZFAIL(heap != NULL);
+  for(i = 0; i < size; i += PAGESIZE)
+    dirty += heap[i] != 0;
+  ZTEST(dirty == 0);
+  for(i = 0; i < size; i += PAGESIZE)
+    heap[i] = (char)0xdb;
+  for(i = 0; i < size; i += PAGESIZE)
+    errors += heap[i] != (char)0xdb;
+  ZTEST(errors == 0);
+
+  free(heap);
+  ZREPORT;
+  return 0;
+}
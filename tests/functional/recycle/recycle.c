@@ -0,0 +1,54 @@
+/*
+ * session recycling test. each request starts the program from the entry
+ * point: the data, bss and heap must be pristine and the code jailed by
+ * the previous session must be gone. each session dirties them for the
+ * next one and leaves the jailed code
+ */
+#include "include/zvmlib.h"
+#include "include/ztest.h"
+
+#define SIZE 0x10000
+
+static int data = 0x1234;
+static int bss;
+
+/* should pass validation */
+static void good()
+{
+  bss = 0;
+}
+
+int main()
+{
+  char *p;
+  int dirty = 0;
+  int i;
+
+  /* r/w data and bss are restored */
+  ZTEST(data == 0x1234);
+  ZTEST(bss == 0);
+  data = 0;
+  bss = 0x1234;
+
+  /* the heap is zeroed and writable (not jailed) */
+  p = malloc(SIZE + PAGESIZE);
+  ZFAIL(p != NULL);
+  p = (char*)(uintptr_t)ROUNDUP_64K((uintptr_t)p);
+  for(i = 0; i < SIZE; ++i)
+    dirty += p[i] != 0;
+  ZTEST(dirty == 0);
+  for(i = 0; i < SIZE; ++i)
+    p[i] = 0xdb;
+
+  /* the code is left jailed for the next session */
+  memcpy(p, good, SIZE);
+  ZTEST(zvm_jail(p, SIZE) == 0);
+
+  /* the recycled session ignores zvm_fork */
+  ZTEST(zvm_fork() == 0);
+
+  /* the same output for the same digest */
+  FPRINTF(STDOUT, "recycled session\n");
+  ZREPORT;
+  return 0;
+}
@@ -0,0 +1,51 @@
+# sends two requests to the recycled session and checks the reports: both
+# sessions are successful and have the same output digest (not cumulative).
+# exits with the failed check number
+import os
+import socket
+import struct
+import sys
+import time
+
+MAGIC = b'ZVMCMD01'
+END, SOURCE = 0, 5
+
+
+def record(kind, data=b''):
+    return struct.pack('=II', kind, len(data)) + data
+
+
+def request(name, err):
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        sock.connect(name)
+        sock.sendall(MAGIC + record(SOURCE, b'/dev/stderr\0' + err)
+                     + record(END))
+        resp = sock.makefile('rb')
+        size = int(resp.read(8), 0)
+        return [l.split(' = ')[-1]
+                for l in resp.read(size).decode().split('\n')]
+    finally:
+        sock.close()
+
+
+def check(case, cond):
+    if not cond:
+        sys.stdout.write('check %d failed\n' % case)
+        sys.exit(case)
+
+# the session waits for the 1st request on the "Job" socket
+for i in range(100):
+    if os.path.exists(sys.argv[1]):
+        break
+    time.sleep(0.1)
+
+pwd = os.getcwd().encode()
+reports = [request(sys.argv[1], pwd + b'/err%d.log' % i) for i in (1, 2)]
+for r in reports:
+    check(1, r[2] == '0')  # user return code
+    check(2, r[5] == 'ok')  # exit state
+    check(3, r[1] == '0')  # no daemon started by zvm_fork
+check(4, reports[0][3] == reports[1][3])  # etag
+for i in (1, 2):
+    check(5, 'TEST SUCCEED' in open('err%d.log' % i).read())
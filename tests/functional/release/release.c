@@ -0,0 +1,53 @@
+/*
+ * functional test of trap function release
+ */
+#include "include/zvmlib.h"
+#include "include/ztest.h"
+
+#define EINVAL 22
+#define SIZE (4 * PAGESIZE)
+
+int main()
+{
+  char *p, *g;
+  char local;
+  int i;
+  int zeroes = 0;
+
+  /* allocate, align and populate buffer */
+  g = malloc(SIZE + PAGESIZE);
+  ZFAIL(g != NULL);
+  p = (char*)(uintptr_t)(ROUNDUP_64K((uintptr_t)g));
+  memset(p, 0xdb, SIZE);
+
+  /* incorrect requests */
+  ZTEST(zvm_release(p + 1, PAGESIZE) == -EINVAL);
+  ZTEST(zvm_release(p, 0) == -EINVAL);
+  ZTEST(zvm_release(&local, PAGESIZE) == -EINVAL);
+  ZTEST(zvm_release(p, 0x7fffffff) == -EINVAL);
+  ZTEST(zvm_release(p, 100) == -EINVAL);
+  ZTEST(zvm_release(p, PAGESIZE + 1) == -EINVAL);
+
+  /* the rejected requests left the data intact */
+  ZTEST(p[0] == (char)0xdb);
+  ZTEST(p[100] == (char)0xdb);
+  ZTEST(p[PAGESIZE] == (char)0xdb);
+
+  /* release of the first page keeps the following bytes */
+  ZTEST(zvm_release(p, PAGESIZE) == 0);
+  ZTEST(p[PAGESIZE - 1] == 0);
+  ZTEST(p[PAGESIZE] == (char)0xdb);
+  ZTEST(p[SIZE - 1] == (char)0xdb);
+
+  /* release and check the memory is available and zeroed */
+  ZTEST(zvm_release(p, SIZE) == 0);
+  for(i = 0; i < SIZE; ++i)
+    zeroes += p[i] == 0;
+  ZTEST(zeroes == SIZE);
+  memset(p, 0xdb, SIZE);
+  ZTEST(p[SIZE - 1] == (char)0xdb);
+
+  free(g);
+  ZREPORT;
+  return 0;
+}
@@ -0,0 +1,48 @@
+/*
+ * functional test of trap function save. the 1st session saves the
+ * image, the 2nd one is restored from it
+ */
+#include "include/zvmlib.h"
+#include "include/ztest.h"
+
+#define EPERM 1
+#define SIZE (4 * PAGESIZE)
+#define PATTERN 0xdb
+
+static int initialized = 0;
+
+int main()
+{
+  char *p;
+  int result;
+  int i;
+  int intact = 1;
+
+  /* "expensive" initialization */
+  p = malloc(SIZE);
+  ZFAIL(p != NULL);
+  memset(p, PATTERN, SIZE);
+  initialized = 1;
+
+  /* the saving session ends here */
+  result = zvm_save();
+  if(result == 0)
+  {
+    ZTEST(initialized == 1);
+    ZREPORT;
+  }
+
+  /* the restored session continues with the saved memory */
+  ZTEST(result == 1);
+  ZTEST(initialized == 1);
+  for(i = 0; i < SIZE; ++i)
+    if(p[i] != (char)PATTERN) intact = 0;
+  ZTEST(intact == 1);
+
+  /* the new manifest has no "Save" */
+  ZTEST(MANIFEST->channels_count == 3);
+  ZTEST(zvm_save() == -EPERM);
+
+  ZREPORT;
+  return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * functional test of trap functions spawn and wait
+ */
+#include "include/zvmlib.h"
+#include "include/ztest.h"
+
+#define EINVAL 22
+#define ECHILD 10
+#define CHILDREN 4
+#define RW "/dev/rw"
+
+static int shared = 1;
+
+int main()
+{
+  int codes[CHILDREN];
+  char buf[6];
+  int index;
+  int i;
+
+  /* the r/w channel content must be seen by the children */
+  ZTEST(PWRITE(RW, "parent", 6, 0) == 6);
+
+  /* incorrect requests */
+  ZTEST(zvm_spawn(0) == -EINVAL);
+  ZTEST(zvm_spawn(0x7fffffff) == -EINVAL);
+  ZTEST(zvm_wait(codes, CHILDREN) == -ECHILD);
+
+  /* children change the memory and the r/w channel, return own index */
+  index = zvm_spawn(CHILDREN);
+  if(index > 0)
+  {
+    if(PREAD(RW, buf, 6, 0) != 6 || MEMCMP(buf, "parent", 6) != 0)
+      zvm_exit(-1);
+    PWRITE(RW, "child!", 6, 0);
+    shared = index;
+    zvm_exit(index * 10 + shared);
+  }
+
+  /* parent waits for the children */
+  ZTEST(index == 0);
+  ZTEST(zvm_wait(codes, CHILDREN - 1) == -EINVAL);
+  ZTEST(zvm_wait(codes, CHILDREN) == 0);
+  for(i = 0; i < CHILDREN; ++i)
+    ZTEST(codes[i] == (i + 1) * 11);
+
+  /* the parent memory and channel are intact, children are gone */
+  ZTEST(shared == 1);
+  ZTEST(PREAD(RW, buf, 6, 0) == 6);
+  ZTEST(MEMCMP(buf, "parent", 6) == 0);
+  ZTEST(zvm_wait(codes, CHILDREN) == -ECHILD);
+
+  ZREPORT;
+  return 0;
+}
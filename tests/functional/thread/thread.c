@@ -0,0 +1,66 @@
+/*
+ * functional test of trap functions thread and join
+ */
+#include "include/zvmlib.h"
+#include "include/ztest.h"
+
+#define EINVAL 22
+#define ESRCH 3
+#define EBUSY 16
+#define THREADS 4
+#define STACK_SIZE (4 * PAGESIZE)
+
+static volatile int64_t sums[THREADS];
+
+/* sum numbers from 1 to 1000 * (n + 1) and exit with n */
+static void Worker(uint32_t n)
+{
+  int i;
+
+  for(i = 1; i <= 1000 * (n + 1); ++i)
+    sums[n] += i;
+  zvm_exit(n + 100);
+}
+
+int main()
+{
+  char *stacks, *g;
+  int ids[THREADS];
+  char local;
+  int i;
+
+  /* allocate and align stacks */
+  g = malloc(THREADS * STACK_SIZE + PAGESIZE);
+  ZFAIL(g != NULL);
+  stacks = (char*)(uintptr_t)(ROUNDUP_64K((uintptr_t)g));
+
+  /* incorrect requests */
+  ZTEST(zvm_thread((char*)Worker + 1, 0, stacks, STACK_SIZE) == -EINVAL);
+  ZTEST(zvm_thread(stacks, 0, stacks, STACK_SIZE) == -EINVAL);
+  ZTEST(zvm_thread(Worker, 0, stacks, 16) == -EINVAL);
+  ZTEST(zvm_thread(Worker, 0, &local, STACK_SIZE) == -EINVAL);
+  ZTEST(zvm_join(0) == -EINVAL);
+  ZTEST(zvm_join(1) == -ESRCH);
+
+  /* start threads and wait for them */
+  for(i = 0; i < THREADS; ++i)
+  {
+    ids[i] = zvm_thread(Worker, i, stacks + i * STACK_SIZE, STACK_SIZE);
+    ZTEST(ids[i] > 0);
+  }
+  ZTEST(zvm_fork() == -EBUSY);
+  for(i = 0; i < THREADS; ++i)
+    ZTEST(zvm_join(ids[i]) == i + 100);
+
+  /* check results and that threads are gone */
+  for(i = 0; i < THREADS; ++i)
+  {
+    int64_t n = 1000 * (i + 1);
+    ZTEST(sums[i] == n * (n + 1) / 2);
+  }
+  ZTEST(zvm_join(ids[0]) == -ESRCH);
+
+  free(g);
+  ZREPORT;
+  return 0;
+}
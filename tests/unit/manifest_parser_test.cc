@@ -7,6 +7,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <linux/mempolicy.h>
 #include "gtest/gtest.h"
 #include "src/main/manifest.h"
 #include "src/main/tools.h"
@@ -84,6 +85,95 @@ TEST(ManifestTests, ManifestParserTest)
 }
 #endif
 
+// the smallest valid manifest
+#define BASE_MANIFEST \
+      "Version = 20130611\n"\
+      "Program = test.nexe\n"\
+      "Memory = 33554432, 0\n"\
+      "Timeout = 1\n"\
+      "Channel = /dev/null, /dev/stdin, 0, 0, 1, 1, 0, 0\n"\
+      "Channel = /dev/null, /dev/stdout, 0, 0, 0, 0, 1, 1\n"\
+      "Channel = /dev/null, /dev/stderr, 0, 0, 0, 0, 1, 1\n"
+
+// parse the base manifest with the given extra lines
+static struct Manifest *Parse(const char *extra)
+{
+  char *text = g_strconcat(BASE_MANIFEST, extra, NULL);
+  struct Manifest *manifest = ManifestTextCtor(text);
+
+  g_free(text);
+  return manifest;
+}
+
+// memory placement keywords are off by default
+TEST(ManifestTests, MemoryDefaults)
+{
+  struct Manifest *manifest = Parse("");
+
+  EXPECT_EQ(0, manifest->huge_pages);
+  EXPECT_EQ(0, manifest->prefault);
+  EXPECT_TRUE(manifest->cpus == NULL);
+  EXPECT_EQ(0u, manifest->numa_nodes);
+  EXPECT_EQ(MPOL_DEFAULT, manifest->mem_policy);
+  ManifestDtor(manifest);
+}
+
+TEST(ManifestTests, HugePagesAndPrefault)
+{
+  struct Manifest *manifest = Parse("HugePages = 2\nPrefault = 1\n");
+
+  EXPECT_EQ(2, manifest->huge_pages);
+  EXPECT_EQ(1, manifest->prefault);
+  ManifestDtor(manifest);
+
+  EXPECT_DEATH(Parse("HugePages = 3\n"), "");
+  EXPECT_DEATH(Parse("HugePages = -1\n"), "");
+  EXPECT_DEATH(Parse("Prefault = 3\n"), "");
+  EXPECT_DEATH(Parse("Prefault = 1\nPrefault = 2\n"), "");
+}
+
+TEST(ManifestTests, CpuSet)
+{
+  struct Manifest *manifest = Parse("CpuSet = 0-2, 5\n");
+
+  ASSERT_TRUE(manifest->cpus != NULL);
+  EXPECT_EQ(4, CPU_COUNT(manifest->cpus));
+  EXPECT_TRUE(CPU_ISSET(0, manifest->cpus));
+  EXPECT_TRUE(CPU_ISSET(2, manifest->cpus));
+  EXPECT_FALSE(CPU_ISSET(3, manifest->cpus));
+  EXPECT_TRUE(CPU_ISSET(5, manifest->cpus));
+  ManifestDtor(manifest);
+
+  EXPECT_DEATH(Parse("CpuSet = 3-1\n"), "");
+  EXPECT_DEATH(Parse("CpuSet = 1-2-3\n"), "");
+  EXPECT_DEATH(Parse("CpuSet = -1\n"), "");
+}
+
+TEST(ManifestTests, NumaNodeAndMemPolicy)
+{
+  struct Manifest *manifest = Parse("NumaNode = 1, 3\n");
+
+  // the nodes without policy are bound
+  EXPECT_EQ(0xau, manifest->numa_nodes);
+  EXPECT_EQ(MPOL_BIND, manifest->mem_policy);
+  ManifestDtor(manifest);
+
+  manifest = Parse("NumaNode = 0-1\nMemPolicy = interleave\n");
+  EXPECT_EQ(3u, manifest->numa_nodes);
+  EXPECT_EQ(MPOL_INTERLEAVE, manifest->mem_policy);
+  ManifestDtor(manifest);
+
+  manifest = Parse("NumaNode = 2\nMemPolicy = preferred\n");
+  EXPECT_EQ(4u, manifest->numa_nodes);
+  EXPECT_EQ(MPOL_PREFERRED, manifest->mem_policy);
+  ManifestDtor(manifest);
+
+  EXPECT_DEATH(Parse("NumaNode = 64\n"), "");
+  EXPECT_DEATH(Parse("NumaNode = 0\nMemPolicy = local\n"), "");
+  EXPECT_DEATH(Parse("MemPolicy = bind\n"), "");
+  EXPECT_DEATH(Parse("NumaNode = 0, 1\nMemPolicy = preferred\n"), "");
+}
+
 int main(int argc, char *argv[]) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
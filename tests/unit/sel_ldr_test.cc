@@ -6,9 +6,17 @@
  * update(d'b): i think this test can be removed (or should be rewritten)
  */
 
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
 #include "src/loader/sel_ldr.h"
+#include "src/loader/sel_addrspace.h"
 #include "gtest/gtest.h"
 
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
 //
 // There are several problems in how these tests are set up.
 //
@@ -70,3 +78,38 @@ TEST_F(SelLdrTest, DescTable) {
   ASSERT_EQ(0u, app.initial_entry_pt);
   ASSERT_EQ(0u, app.user_entry_pt);
 }
+
+// the occupied preferred slot is skipped, the user space takes the next one
+TEST_F(SelLdrTest, AddressSpaceSlot) {
+  struct NaClApp app = {0};
+  struct Manifest manifest;
+  void *blocker;
+  uintptr_t slot;
+
+  memset(&manifest, 0, sizeof manifest);
+  NaClAppCtor(&app);
+  app.manifest = &manifest;
+  app.data_end = NACL_MAP_PAGESIZE;
+
+  // occupy the preferred slot. the test is skipped if it is not free
+  blocker = mmap((void*)SANDBOX_BASE, NACL_MAP_PAGESIZE,
+      PROT_READ | PROT_WRITE, RELATIVE_MMAP | MAP_FIXED_NOREPLACE, -1, 0);
+  if(blocker != (void*)SANDBOX_BASE)
+  {
+    if(blocker != MAP_FAILED) munmap(blocker, NACL_MAP_PAGESIZE);
+    fprintf(stderr, "the preferred slot is not free, test skipped\n");
+    return;
+  }
+  *(char*)blocker = 'z';
+
+  AllocAddrSpace(&app);
+  slot = app.mem_start - GUARDSIZE;
+  EXPECT_LT(SANDBOX_BASE, slot);
+  EXPECT_EQ(0u, (slot - SANDBOX_BASE) % SANDBOX_SPAN);
+
+  // the blocker is not clobbered
+  EXPECT_EQ('z', *(char*)blocker);
+  EXPECT_EQ(0, munmap(blocker, NACL_MAP_PAGESIZE));
+  FreeAddrSpace(&app);
+  EXPECT_EQ(0u, app.mem_start);
+}